@@ -1,8 +1,11 @@
 #ifndef SW_BASE_H_INCLUDED
 #define SW_BASE_H_INCLUDED
 
+#include <type_traits>
+
 #include "utils.h"
 #include "proxy.h"
+#include "profile.h"
 
 namespace tuz
 {
@@ -10,19 +13,27 @@ namespace tuz
 template<typename T, typename P>
 class SW_base
 {
+public:
+    //T[] and T[N] handles point at the first element
+    typedef typename std::remove_extent<T>::type element_type;
+
 protected:
-    Proxy_base<T>* proxy;
+    //kept next to the proxy, so dereferencing doesn't have to load the proxy
+    element_type* ptr = nullptr;
+    //an empty handle has no proxy at all, so it never writes a shared counter
+    Proxy_base* proxy = nullptr;
 
     void swap(SW_base<T, P>& swb) noexcept;
     void check_out() noexcept;
     void check_in() noexcept;
-    void set_proxy(Proxy_base<T>* another_proxy = Proxy_dummy<T>::instance_ptr()) noexcept;
+    void set_proxy(Proxy_base* another_proxy = nullptr, element_type* another_ptr = nullptr) noexcept;
+    void adopt_proxy(Proxy_base* another_proxy, element_type* another_ptr) noexcept;
 
 public:
     size_t use_count() const noexcept;
 
 #ifdef DEBUG
-    const Proxy_base<T>* DEBUG_get_proxy_addr() const noexcept
+    const Proxy_base* DEBUG_get_proxy_addr() const noexcept
     {
         return proxy;
     };
@@ -30,35 +41,51 @@ public:
 };
 
 template<typename T, typename P>
-void SW_base<T, P>::set_proxy(Proxy_base<T>* another_proxy) noexcept
+void SW_base<T, P>::set_proxy(Proxy_base* another_proxy, element_type* another_ptr) noexcept
 {
-    proxy = another_proxy;
+    adopt_proxy(another_proxy, another_ptr);
     check_in();
 }
 
+template<typename T, typename P>
+void SW_base<T, P>::adopt_proxy(Proxy_base* another_proxy, element_type* another_ptr) noexcept
+{
+    proxy = another_proxy;
+    ptr = another_ptr;
+}
+
 template<typename T, typename P>
 void SW_base<T, P>::check_out() noexcept
 {
-    proxy->check_out(Identity<P>());
-    if(proxy->need_deletion())
-        delete proxy;
+    if(!proxy)
+        return;
+
+    profile_link<P>(Link_event::check_out);
+
+    if(proxy->check_out(Identity<P>()))
+        proxy->destroy();
 }
 
 template<typename T, typename P>
 void SW_base<T, P>::check_in() noexcept
 {
+    if(!proxy)
+        return;
+
+    profile_link<P>(Link_event::check_in);
     proxy->check_in(Identity<P>());
 }
 
 template<typename T, typename P>
 size_t SW_base<T, P>::use_count() const noexcept
 {
-    return proxy->links_count();
+    return proxy ? proxy->links_count() : 0;
 }
 
 template<typename T, typename P>
 void SW_base<T, P>::swap(SW_base<T, P>& swb) noexcept
 {
+    std::swap(ptr, swb.ptr);
     std::swap(proxy, swb.proxy);
 }
 
@@ -0,0 +1,314 @@
+#ifndef ATOMIC_SHARED_PTR_H_INCLUDED
+#define ATOMIC_SHARED_PTR_H_INCLUDED
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <thread>
+
+#include "smart_ptr.h"
+
+namespace tuz
+{
+
+//what the holder proxy of an atomic_shared_ptr keeps
+template<typename T>
+struct Atomic_stored
+{
+    shared_ptr<T> value;
+
+    explicit Atomic_stored(const shared_ptr<T>& value) : value(value) {};
+};
+
+//the holder and the links of its batches are not links to T
+template<typename T>
+struct Instrument_skips<Atomic_stored<T>> : std::true_type
+{
+};
+
+//A stored value lives in a holder proxy, and the holder pointer shares one
+//64-bit word with a local link count. Each holder is checked in batch_links
+//times in advance, and a reader pins the holder by taking one of those links
+//with a single compare_exchange on the word, so readers never take a lock.
+//While the holder is pinned the reader copies the stored shared_ptr, so a
+//loaded pointer owns an ordinary link on the proxy of the object and the
+//holder link goes back. Whoever replaces the word gives the unused part of
+//the batch back. A null pointer is stored as an empty word.
+//Under TUZ_INSTRUMENT only the links a reader pins count, as links of T.
+//Every reader that finds half of the batch taken checks in more links, and
+//the word always keeps one, so the local count can't run past the batch.
+template<typename T>
+class atomic_shared_ptr
+{
+    static_assert(sizeof(void*) == sizeof(uint64_t), "atomic_shared_ptr packs 48-bit pointers into a 64-bit word");
+
+private:
+    typedef Make_shared_proxy<Atomic_stored<T>> Holder;
+
+    static constexpr unsigned count_shift = 48;
+    static constexpr uint64_t one_link = uint64_t(1) << count_shift;
+    static constexpr uint64_t pointer_mask = one_link - 1;
+    static constexpr size_t batch_links = size_t(1) << 15;
+    static constexpr size_t refill_links = batch_links / 2;
+    static constexpr size_t max_links = batch_links - 1;
+
+    mutable std::atomic<uint64_t> word;
+
+    atomic_shared_ptr(const atomic_shared_ptr&) = delete;
+    atomic_shared_ptr& operator=(const atomic_shared_ptr&) = delete;
+
+    static Holder* holder_of(uint64_t w) noexcept;
+    static size_t links_of(uint64_t w) noexcept;
+    static uint64_t take(const shared_ptr<T>& sp);
+    static void give_back(uint64_t w) noexcept;
+    void refill(Holder* holder) const noexcept;
+    Holder* pin() const noexcept;
+    static void unpin(Holder* holder) noexcept;
+
+public:
+    static constexpr bool is_always_lock_free = std::atomic<uint64_t>::is_always_lock_free;
+
+    atomic_shared_ptr() noexcept;
+    atomic_shared_ptr(const shared_ptr<T>& sp);
+    ~atomic_shared_ptr();
+
+    bool is_lock_free() const noexcept;
+
+    shared_ptr<T> load() const noexcept;
+    void store(const shared_ptr<T>& sp);
+    shared_ptr<T> exchange(const shared_ptr<T>& sp);
+    bool compare_exchange_weak(shared_ptr<T>& expected, const shared_ptr<T>& desired);
+    bool compare_exchange_strong(shared_ptr<T>& expected, const shared_ptr<T>& desired);
+
+    operator shared_ptr<T>() const noexcept;
+    void operator=(const shared_ptr<T>& sp);
+};
+
+template<typename T>
+typename atomic_shared_ptr<T>::Holder* atomic_shared_ptr<T>::holder_of(uint64_t w) noexcept
+{
+    return reinterpret_cast<Holder*>(w & pointer_mask);
+}
+
+template<typename T>
+size_t atomic_shared_ptr<T>::links_of(uint64_t w) noexcept
+{
+    return w >> count_shift;
+}
+
+template<typename T>
+uint64_t atomic_shared_ptr<T>::take(const shared_ptr<T>& sp)
+{
+    if(!sp)
+        return 0;
+
+    Holder* holder = new Holder(sp);
+    holder->check_in(Identity<shared_ptr<Atomic_stored<T>>>(), batch_links);
+
+    return reinterpret_cast<uint64_t>(holder);
+}
+
+//checks out the part of the batch no reader has taken
+template<typename T>
+void atomic_shared_ptr<T>::give_back(uint64_t w) noexcept
+{
+    Holder* holder = holder_of(w);
+
+    assert(links_of(w) <= batch_links && "more links taken than the batch has");
+
+    size_t unused = batch_links - links_of(w);
+
+    if(holder && unused && holder->check_out(Identity<shared_ptr<Atomic_stored<T>>>(), unused))
+        holder->destroy();
+}
+
+//called by every reader that takes a link to holder while the local count
+//runs high; whoever gets there first refills, the others give theirs back
+template<typename T>
+void atomic_shared_ptr<T>::refill(Holder* holder) const noexcept
+{
+    holder->check_in(Identity<shared_ptr<Atomic_stored<T>>>(), refill_links);
+
+    uint64_t current = word.load(std::memory_order_relaxed);
+
+    while(holder_of(current) == holder && links_of(current) >= refill_links)
+        if(word.compare_exchange_weak(current, current - refill_links * one_link, std::memory_order_relaxed))
+            return;
+
+    //someone else replaced the word, our own link keeps holder alive
+    holder->check_out(Identity<shared_ptr<Atomic_stored<T>>>(), refill_links);
+}
+
+//the holder can't go away until unpin(), null when nothing is stored
+template<typename T>
+typename atomic_shared_ptr<T>::Holder* atomic_shared_ptr<T>::pin() const noexcept
+{
+    uint64_t w = word.load(std::memory_order_relaxed);
+    Holder* holder;
+
+    while(true)
+    {
+        holder = holder_of(w);
+
+        if(!holder)
+            return nullptr;
+
+        //the readers ahead of us are late to refill, wait for them
+        if(links_of(w) >= max_links)
+        {
+            std::this_thread::yield();
+            w = word.load(std::memory_order_relaxed);
+        }
+        else if(word.compare_exchange_weak(w, w + one_link, std::memory_order_acquire, std::memory_order_relaxed))
+            break;
+    }
+
+    instrument<T>(Instrument_event::shared_check_in);
+
+    if(links_of(w) + 1 >= refill_links)
+        refill(holder);
+
+    return holder;
+}
+
+template<typename T>
+void atomic_shared_ptr<T>::unpin(Holder* holder) noexcept
+{
+    if(holder && holder->check_out(Identity<shared_ptr<T>>()))
+        holder->destroy();
+}
+
+template<typename T>
+atomic_shared_ptr<T>::atomic_shared_ptr() noexcept :
+    word(0)
+{
+}
+
+template<typename T>
+atomic_shared_ptr<T>::atomic_shared_ptr(const shared_ptr<T>& sp) :
+    word(take(sp))
+{
+}
+
+template<typename T>
+atomic_shared_ptr<T>::~atomic_shared_ptr()
+{
+    give_back(word.load(std::memory_order_acquire));
+}
+
+template<typename T>
+bool atomic_shared_ptr<T>::is_lock_free() const noexcept
+{
+    return word.is_lock_free();
+}
+
+template<typename T>
+shared_ptr<T> atomic_shared_ptr<T>::load() const noexcept
+{
+    Holder* holder = pin();
+
+    if(!holder)
+        return shared_ptr<T>();
+
+    shared_ptr<T> loaded = holder->get()->value;
+    unpin(holder);
+
+    return loaded;
+}
+
+template<typename T>
+void atomic_shared_ptr<T>::store(const shared_ptr<T>& sp)
+{
+    give_back(word.exchange(take(sp), std::memory_order_acq_rel));
+}
+
+template<typename T>
+shared_ptr<T> atomic_shared_ptr<T>::exchange(const shared_ptr<T>& sp)
+{
+    uint64_t old = word.exchange(take(sp), std::memory_order_acq_rel);
+    Holder* holder = holder_of(old);
+
+    if(!holder)
+        return shared_ptr<T>();
+
+    //the links of the word keep the holder alive while it is copied
+    shared_ptr<T> previous = holder->get()->value;
+    give_back(old);
+
+    return previous;
+}
+
+template<typename T>
+bool atomic_shared_ptr<T>::compare_exchange_weak(shared_ptr<T>& expected, const shared_ptr<T>& desired)
+{
+    return compare_exchange_strong(expected, desired);
+}
+
+//equal values share the object pointer and the owner; the pinned holder
+//can't be freed and reused for another value while it is compared.
+//The holder of desired is made only once a compare succeeds, and kept
+//if the word changes before it goes in.
+template<typename T>
+bool atomic_shared_ptr<T>::compare_exchange_strong(shared_ptr<T>& expected, const shared_ptr<T>& desired)
+{
+    uint64_t fresh = 0;
+    bool taken = false;
+
+    while(true)
+    {
+        Holder* holder = pin();
+        const shared_ptr<T>* current = holder ? &holder->get()->value : nullptr;
+
+        if(current ? current->ptr != expected.ptr || current->proxy != expected.proxy : bool(expected))
+        {
+            expected = current ? *current : shared_ptr<T>();
+            unpin(holder);
+            give_back(fresh);
+            return false;
+        }
+
+        if(!taken)
+        {
+            try
+            {
+                fresh = take(desired);
+            }
+            catch(...)
+            {
+                unpin(holder);
+                throw;
+            }
+
+            taken = true;
+        }
+
+        //only the local count may change under us while the holder stays
+        uint64_t w = word.load(std::memory_order_acquire);
+
+        while(holder_of(w) == holder)
+            if(word.compare_exchange_weak(w, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                give_back(w);
+                unpin(holder);
+                return true;
+            }
+
+        unpin(holder);
+    }
+}
+
+template<typename T>
+atomic_shared_ptr<T>::operator shared_ptr<T>() const noexcept
+{
+    return load();
+}
+
+template<typename T>
+void atomic_shared_ptr<T>::operator=(const shared_ptr<T>& sp)
+{
+    store(sp);
+}
+
+}
+
+#endif // ATOMIC_SHARED_PTR_H_INCLUDED
@@ -0,0 +1,929 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "smart_ptr.h"
+#include "atomic_shared_ptr.h"
+#include "relocate.h"
+#include "local_shared_ptr.h"
+#include "intrusive_ptr.h"
+#include "deferred.h"
+#include "cycles.h"
+
+using namespace tuz;
+
+struct Config
+{
+    int value;
+
+    explicit Config(int value) : value(value) {};
+};
+
+//read-mostly publication: every thread loads, thread 0 also stores now and then
+static atomic_shared_ptr<Config> published_config(make_shared<Config>(0));
+
+static void BM_atomic_shared_ptr_load(benchmark::State& state)
+{
+    int i = 0;
+
+    for(auto _ : state)
+    {
+        if(!state.thread_index() && !(++i & 1023))
+            published_config.store(make_shared<Config>(i));
+
+        shared_ptr<Config> config = published_config.load();
+        benchmark::DoNotOptimize(config->value);
+    }
+}
+BENCHMARK(BM_atomic_shared_ptr_load)->ThreadRange(1, 16)->UseRealTime();
+
+static std::mutex config_mutex;
+static shared_ptr<Config> guarded_config = make_shared<Config>(0);
+
+static void BM_mutex_shared_ptr_load(benchmark::State& state)
+{
+    int i = 0;
+
+    for(auto _ : state)
+    {
+        if(!state.thread_index() && !(++i & 1023))
+        {
+            shared_ptr<Config> fresh = make_shared<Config>(i);
+            std::lock_guard<std::mutex> lock(config_mutex);
+            guarded_config.swap(fresh);
+        }
+
+        shared_ptr<Config> config;
+        {
+            std::lock_guard<std::mutex> lock(config_mutex);
+            config = guarded_config;
+        }
+        benchmark::DoNotOptimize(config->value);
+    }
+}
+BENCHMARK(BM_mutex_shared_ptr_load)->ThreadRange(1, 16)->UseRealTime();
+
+//empty handles come and go in every worker; with a shared dummy proxy all
+//threads would write one counter
+static void BM_empty_shared_ptr_churn(benchmark::State& state)
+{
+    for(auto _ : state)
+    {
+        shared_ptr<Config> empty;
+        weak_ptr<Config> weak;
+        shared_ptr<Config> moved(std::move(empty));
+        benchmark::DoNotOptimize(moved);
+        benchmark::DoNotOptimize(weak);
+    }
+}
+BENCHMARK(BM_empty_shared_ptr_churn)->ThreadRange(1, 16)->UseRealTime();
+
+struct Node
+{
+    long value;
+
+    explicit Node(long value) : value(value) {};
+};
+
+//the same node with its count inside
+struct Intrusive_node : intrusive_ref_counter<Intrusive_node>
+{
+    long value;
+
+    explicit Intrusive_node(long value) : value(value) {};
+};
+
+//objects and proxies come from separate allocations and are visited in a
+//shuffled order, so neither is in cache when it is dereferenced
+template<typename P, typename N = Node>
+static void pointer_chasing(benchmark::State& state)
+{
+    std::vector<P> nodes;
+    for(long i = 0; i < state.range(0); ++i)
+        nodes.emplace_back(new N(i));
+
+    std::shuffle(nodes.begin(), nodes.end(), std::mt19937(228));
+
+    for(auto _ : state)
+    {
+        long sum = 0;
+        for(const P& node : nodes)
+            sum += node->value;
+        benchmark::DoNotOptimize(sum);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_pointer_chasing_tuz(benchmark::State& state)
+{
+    pointer_chasing<shared_ptr<Node>>(state);
+}
+BENCHMARK(BM_pointer_chasing_tuz)->Arg(1 << 12)->Arg(1 << 22);
+
+static void BM_pointer_chasing_std(benchmark::State& state)
+{
+    pointer_chasing<std::shared_ptr<Node>>(state);
+}
+BENCHMARK(BM_pointer_chasing_std)->Arg(1 << 12)->Arg(1 << 22);
+
+static void BM_pointer_chasing_intrusive(benchmark::State& state)
+{
+    pointer_chasing<intrusive_ptr<Intrusive_node>, Intrusive_node>(state);
+}
+BENCHMARK(BM_pointer_chasing_intrusive)->Arg(1 << 12)->Arg(1 << 22);
+
+template<template<typename> class P>
+struct Tree_node
+{
+    long value;
+    P<Tree_node> left, right;
+
+    explicit Tree_node(long value) : value(value) {};
+};
+
+template<typename T>
+static void make_node(shared_ptr<T>& node, long value)
+{
+    node = make_shared<T>(value);
+}
+
+template<typename T>
+static void make_node(local_shared_ptr<T>& node, long value)
+{
+    node = make_local_shared<T>(value);
+}
+
+template<template<typename> class P>
+static P<Tree_node<P>> build_tree(int depth, long& value)
+{
+    P<Tree_node<P>> node;
+    make_node(node, value++);
+
+    if(depth)
+    {
+        node->left = build_tree<P>(depth - 1, value);
+        node->right = build_tree<P>(depth - 1, value);
+    }
+
+    return node;
+}
+
+//the visitor takes every node by value, so each step copies and drops a link
+template<template<typename> class P>
+static long visit(P<Tree_node<P>> node)
+{
+    if(!node)
+        return 0;
+
+    return node->value + visit<P>(node->left) + visit<P>(node->right);
+}
+
+template<template<typename> class P>
+static void tree_traversal(benchmark::State& state)
+{
+    long value = 0;
+    P<Tree_node<P>> root = build_tree<P>(state.range(0), value);
+
+    for(auto _ : state)
+        benchmark::DoNotOptimize(visit<P>(root));
+
+    state.SetItemsProcessed(state.iterations() * value);
+}
+
+static void BM_tree_traversal_shared(benchmark::State& state)
+{
+    tree_traversal<shared_ptr>(state);
+}
+BENCHMARK(BM_tree_traversal_shared)->Arg(16);
+
+static void BM_tree_traversal_local(benchmark::State& state)
+{
+    tree_traversal<local_shared_ptr>(state);
+}
+BENCHMARK(BM_tree_traversal_local)->Arg(16);
+
+//dropping the root of a 10M-node list, which is a tree where every node
+//has only a left child and far deeper than the stack, and of a balanced
+//tree of 8M nodes. Building is not timed.
+static shared_ptr<Tree_node<shared_ptr>> build_list(long length)
+{
+    shared_ptr<Tree_node<shared_ptr>> head;
+
+    for(long i = 0; i < length; ++i)
+    {
+        shared_ptr<Tree_node<shared_ptr>> node = make_shared<Tree_node<shared_ptr>>(i);
+        node->left = std::move(head);
+        head = std::move(node);
+    }
+
+    return head;
+}
+
+template<typename F>
+static void teardown(benchmark::State& state, long nodes, F build)
+{
+    for(auto _ : state)
+    {
+        shared_ptr<Tree_node<shared_ptr>> root = build();
+
+        auto start = std::chrono::steady_clock::now();
+        root.reset();
+        auto finish = std::chrono::steady_clock::now();
+
+        state.SetIterationTime(std::chrono::duration<double>(finish - start).count());
+    }
+
+    state.SetItemsProcessed(state.iterations() * nodes);
+}
+
+static void BM_teardown_list(benchmark::State& state)
+{
+    teardown(state, 10000000, []()
+    {
+        return build_list(10000000);
+    });
+}
+BENCHMARK(BM_teardown_list)->Iterations(3)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+static void BM_teardown_tree(benchmark::State& state)
+{
+    teardown(state, (1 << 23) - 1, []()
+    {
+        long value = 0;
+        return build_tree<shared_ptr>(22, value);
+    });
+}
+BENCHMARK(BM_teardown_tree)->Iterations(3)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+//one reallocation of a full vector of 10M handles: std::vector moves and
+//destroys every element, relocating_vector relocates the bytes. Filling
+//the vector is not timed.
+template<typename V>
+static void vector_growth(benchmark::State& state)
+{
+    shared_ptr<Node> node = make_shared<Node>(1);
+
+    for(auto _ : state)
+    {
+        V v;
+        v.reserve(state.range(0));
+        for(long i = 0; i < state.range(0); ++i)
+            v.push_back(node);
+
+        auto start = std::chrono::steady_clock::now();
+        v.push_back(node);
+        auto finish = std::chrono::steady_clock::now();
+
+        benchmark::DoNotOptimize(v.begin());
+        state.SetIterationTime(std::chrono::duration<double>(finish - start).count());
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_vector_growth_std(benchmark::State& state)
+{
+    vector_growth<std::vector<shared_ptr<Node>>>(state);
+}
+BENCHMARK(BM_vector_growth_std)->Arg(10000000)->Iterations(5)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+static void BM_vector_growth_relocating(benchmark::State& state)
+{
+    vector_growth<relocating_vector<shared_ptr<Node>>>(state);
+}
+BENCHMARK(BM_vector_growth_relocating)->Arg(10000000)->Iterations(5)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+//copies and drops of a handle to an object created on this thread or on
+//another one. Build with -DTUZ_BIASED_REFCOUNT to count the links of the
+//creating thread without atomics; local_shared_ptr is the non-atomic bound.
+template<typename P>
+static void copy_loop(benchmark::State& state, const P& original)
+{
+    for(auto _ : state)
+    {
+        P copy(original);
+        benchmark::DoNotOptimize(copy);
+    }
+}
+
+static void BM_copy_shared_own(benchmark::State& state)
+{
+    copy_loop(state, make_shared<Node>(1));
+}
+BENCHMARK(BM_copy_shared_own);
+
+static void BM_copy_shared_foreign(benchmark::State& state)
+{
+    shared_ptr<Node> foreign;
+
+    std::thread([&foreign]()
+    {
+        foreign = make_shared<Node>(1);
+    }).join();
+
+    copy_loop(state, foreign);
+}
+BENCHMARK(BM_copy_shared_foreign);
+
+static void BM_copy_local(benchmark::State& state)
+{
+    copy_loop(state, make_local_shared<Node>(1));
+}
+BENCHMARK(BM_copy_local);
+
+static void BM_copy_intrusive(benchmark::State& state)
+{
+    copy_loop(state, make_intrusive<Intrusive_node>(1));
+}
+BENCHMARK(BM_copy_intrusive);
+
+//each thread copies its own object and one made by thread 0 that all of
+//them share
+static shared_ptr<Node> shared_node;
+
+static void BM_copy_shared_mixed(benchmark::State& state)
+{
+    if(!state.thread_index())
+        shared_node = make_shared<Node>(1);
+
+    shared_ptr<Node> own = make_shared<Node>(2);
+
+    for(auto _ : state)
+    {
+        shared_ptr<Node> a(own);
+        shared_ptr<Node> b(shared_node);
+        benchmark::DoNotOptimize(a);
+        benchmark::DoNotOptimize(b);
+    }
+}
+BENCHMARK(BM_copy_shared_mixed)->ThreadRange(1, 8)->UseRealTime();
+
+//short-lived objects created and dropped at a high rate; build with
+//-DTUZ_POOLED_PROXIES to take the blocks from the thread-local pools
+static void BM_make_shared_churn(benchmark::State& state)
+{
+    std::vector<shared_ptr<Node>> window(64);
+    size_t i = 0;
+
+    for(auto _ : state)
+    {
+        ++i;
+        window[i % window.size()] = make_shared<Node>(long(i));
+    }
+
+    pool_stats stats = get_pool_stats();
+    state.counters["pool_hits"] = stats.hits;
+    state.counters["pool_misses"] = stats.misses;
+}
+BENCHMARK(BM_make_shared_churn);
+
+static void BM_make_intrusive_churn(benchmark::State& state)
+{
+    std::vector<intrusive_ptr<Intrusive_node>> window(64);
+    size_t i = 0;
+
+    for(auto _ : state)
+    {
+        ++i;
+        window[i % window.size()] = make_intrusive<Intrusive_node>(long(i));
+    }
+}
+BENCHMARK(BM_make_intrusive_churn);
+
+//objects that hand out links to themselves; BM_make_shared_churn is the
+//same without enable_shared_from_this
+struct Esft_node : enable_shared_from_this<Esft_node>
+{
+    long value;
+
+    explicit Esft_node(long value) : value(value) {};
+};
+
+static void BM_make_shared_esft_churn(benchmark::State& state)
+{
+    std::vector<shared_ptr<Esft_node>> window(64);
+    size_t i = 0;
+
+    for(auto _ : state)
+    {
+        ++i;
+        window[i % window.size()] = make_shared<Esft_node>(long(i));
+    }
+}
+BENCHMARK(BM_make_shared_esft_churn);
+
+static void BM_shared_from_this(benchmark::State& state)
+{
+    shared_ptr<Esft_node> node = make_shared<Esft_node>(1);
+
+    for(auto _ : state)
+    {
+        shared_ptr<Esft_node> self = node->shared_from_this();
+        benchmark::DoNotOptimize(self);
+    }
+}
+BENCHMARK(BM_shared_from_this);
+
+//the time the releasing thread spends dropping the last link to a map of
+//1M nodes; the deferred one only queues it for the background reclaimer.
+//Building the map is not timed.
+template<typename F>
+static void drop_latency(benchmark::State& state, F make)
+{
+    for(auto _ : state)
+    {
+        std::map<long, long> m;
+        for(long i = 0; i < state.range(0); ++i)
+            m.emplace(i, i);
+
+        shared_ptr<std::map<long, long>> sp = make(std::move(m));
+
+        auto start = std::chrono::steady_clock::now();
+        sp.reset();
+        auto finish = std::chrono::steady_clock::now();
+
+        state.SetIterationTime(std::chrono::duration<double>(finish - start).count());
+    }
+}
+
+static void BM_drop_latency_sync(benchmark::State& state)
+{
+    drop_latency(state, [](std::map<long, long>&& m)
+    {
+        return tuz::make_shared<std::map<long, long>>(std::move(m));
+    });
+}
+BENCHMARK(BM_drop_latency_sync)->Arg(1000000)->Iterations(5)->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+static void BM_drop_latency_deferred(benchmark::State& state)
+{
+    start_deferred_reclaimer();
+    drop_latency(state, [](std::map<long, long>&& m)
+    {
+        return tuz::make_shared_deferred<std::map<long, long>>(std::move(m));
+    });
+    stop_deferred_reclaimer();
+}
+BENCHMARK(BM_drop_latency_deferred)->Arg(1000000)->Iterations(5)->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+//64K garbage rings of four nodes, collected in slices of 1024 possible
+//roots; each ring leaves four roots behind. Building is not timed.
+struct Ring_node
+{
+    shared_ptr<Ring_node> next;
+    long value;
+
+    explicit Ring_node(long value) : value(value) {};
+
+    void trace(cycle_tracer& tracer) const
+    {
+        tracer(next);
+    };
+};
+
+static void BM_collect_cycles(benchmark::State& state)
+{
+    for(auto _ : state)
+    {
+        for(long i = 0; i < state.range(0); ++i)
+        {
+            shared_ptr<Ring_node> first = make_shared_collectable<Ring_node>(i);
+            shared_ptr<Ring_node> node = first;
+
+            for(int j = 0; j < 3; ++j)
+                node = node->next = make_shared_collectable<Ring_node>(i);
+
+            node->next = first;
+        }
+
+        double slowest = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        while(true)
+        {
+            auto slice_start = std::chrono::steady_clock::now();
+            collect_cycles(1024);
+            auto slice_finish = std::chrono::steady_clock::now();
+
+            slowest = std::max(slowest, std::chrono::duration<double, std::micro>(slice_finish - slice_start).count());
+
+            if(!get_cycle_stats().pending_roots)
+                break;
+        }
+
+        auto finish = std::chrono::steady_clock::now();
+
+        state.SetIterationTime(std::chrono::duration<double>(finish - start).count());
+        state.counters["slowest_slice_us"] = slowest;
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0) * 4);
+    state.counters["reclaimed_MB"] = get_cycle_stats().reclaimed_bytes / double(1 << 20);
+}
+BENCHMARK(BM_collect_cycles)->Arg(1 << 16)->Iterations(3)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+static void BM_block_pool_churn(benchmark::State& state)
+{
+    std::vector<void*> window(64, nullptr);
+    size_t i = 0;
+
+    for(auto _ : state)
+    {
+        void*& slot = window[++i % window.size()];
+        Block_pool::deallocate_block(slot);
+        slot = Block_pool::allocate_block(32);
+    }
+
+    for(void* block : window)
+        Block_pool::deallocate_block(block);
+}
+BENCHMARK(BM_block_pool_churn);
+
+static void BM_operator_new_churn(benchmark::State& state)
+{
+    std::vector<void*> window(64, nullptr);
+    size_t i = 0;
+
+    for(auto _ : state)
+    {
+        void*& slot = window[++i % window.size()];
+        ::operator delete(slot);
+        slot = ::operator new(32);
+        benchmark::DoNotOptimize(slot);
+    }
+
+    for(void* block : window)
+        ::operator delete(block);
+}
+BENCHMARK(BM_operator_new_churn);
+
+//tuz against the standard library: every benchmark below runs once with
+//each family of pointers
+struct Tuz_family
+{
+    template<typename T>
+    using shared = tuz::shared_ptr<T>;
+    template<typename T>
+    using weak = tuz::weak_ptr<T>;
+    template<typename T, typename D = tuz::default_delete<T>>
+    using unique = tuz::unique_ptr<T, D>;
+    template<typename T>
+    using from_this = tuz::enable_shared_from_this<T>;
+
+    template<typename T, typename... R>
+    static shared<T> make_shared(R&&... args)
+    {
+        return tuz::make_shared<T>(std::forward<R>(args)...);
+    };
+    template<typename T, typename... R>
+    static unique<T> make_unique(R&&... args)
+    {
+        return tuz::make_unique<T>(std::forward<R>(args)...);
+    };
+};
+
+struct Std_family
+{
+    template<typename T>
+    using shared = std::shared_ptr<T>;
+    template<typename T>
+    using weak = std::weak_ptr<T>;
+    template<typename T, typename D = std::default_delete<T>>
+    using unique = std::unique_ptr<T, D>;
+    template<typename T>
+    using from_this = std::enable_shared_from_this<T>;
+
+    template<typename T, typename... R>
+    static shared<T> make_shared(R&&... args)
+    {
+        return std::make_shared<T>(std::forward<R>(args)...);
+    };
+    template<typename T, typename... R>
+    static unique<T> make_unique(R&&... args)
+    {
+        return std::make_unique<T>(std::forward<R>(args)...);
+    };
+};
+
+template<size_t N>
+struct Payload
+{
+    unsigned char bytes[N];
+};
+
+struct Stateless_delete
+{
+    template<typename T>
+    void operator()(T* ptr) const
+    {
+        delete ptr;
+    };
+};
+
+struct Stateful_delete
+{
+    long* deletes;
+
+    template<typename T>
+    void operator()(T* ptr) const
+    {
+        ++*deletes;
+        delete ptr;
+    };
+};
+
+static void delete_node(Node* ptr)
+{
+    delete ptr;
+}
+
+template<typename F, typename T>
+static void BM_cmp_make_shared(benchmark::State& state)
+{
+    for(auto _ : state)
+    {
+        auto sp = F::template make_shared<T>();
+        benchmark::DoNotOptimize(sp.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_make_shared, Tuz_family, Payload<8>);
+BENCHMARK_TEMPLATE(BM_cmp_make_shared, Std_family, Payload<8>);
+BENCHMARK_TEMPLATE(BM_cmp_make_shared, Tuz_family, Payload<64>);
+BENCHMARK_TEMPLATE(BM_cmp_make_shared, Std_family, Payload<64>);
+BENCHMARK_TEMPLATE(BM_cmp_make_shared, Tuz_family, Payload<512>);
+BENCHMARK_TEMPLATE(BM_cmp_make_shared, Std_family, Payload<512>);
+
+//the proxy and the object are separate allocations
+template<typename F, typename T>
+static void BM_cmp_new_shared(benchmark::State& state)
+{
+    for(auto _ : state)
+    {
+        typename F::template shared<T> sp(new T);
+        benchmark::DoNotOptimize(sp.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_new_shared, Tuz_family, Payload<8>);
+BENCHMARK_TEMPLATE(BM_cmp_new_shared, Std_family, Payload<8>);
+BENCHMARK_TEMPLATE(BM_cmp_new_shared, Tuz_family, Payload<512>);
+BENCHMARK_TEMPLATE(BM_cmp_new_shared, Std_family, Payload<512>);
+
+template<typename F, typename D>
+static void shared_with_deleter(benchmark::State& state, D deleter)
+{
+    for(auto _ : state)
+    {
+        typename F::template shared<Node> sp(new Node(1), deleter);
+        benchmark::DoNotOptimize(sp.get());
+    }
+}
+
+template<typename F>
+static void BM_cmp_shared_stateless_deleter(benchmark::State& state)
+{
+    shared_with_deleter<F>(state, Stateless_delete());
+}
+BENCHMARK_TEMPLATE(BM_cmp_shared_stateless_deleter, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_shared_stateless_deleter, Std_family);
+
+template<typename F>
+static void BM_cmp_shared_stateful_deleter(benchmark::State& state)
+{
+    long deletes = 0;
+    shared_with_deleter<F>(state, Stateful_delete{&deletes});
+}
+BENCHMARK_TEMPLATE(BM_cmp_shared_stateful_deleter, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_shared_stateful_deleter, Std_family);
+
+template<typename F>
+static void BM_cmp_shared_function_deleter(benchmark::State& state)
+{
+    shared_with_deleter<F>(state, &delete_node);
+}
+BENCHMARK_TEMPLATE(BM_cmp_shared_function_deleter, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_shared_function_deleter, Std_family);
+
+template<typename F>
+static void BM_cmp_copy(benchmark::State& state)
+{
+    auto original = F::template make_shared<Node>(1);
+
+    for(auto _ : state)
+    {
+        typename F::template shared<Node> copy(original);
+        benchmark::DoNotOptimize(copy.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_copy, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_copy, Std_family);
+
+template<typename F>
+static void BM_cmp_move(benchmark::State& state)
+{
+    auto a = F::template make_shared<Node>(1);
+
+    for(auto _ : state)
+    {
+        typename F::template shared<Node> b(std::move(a));
+        benchmark::DoNotOptimize(b.get());
+        a = std::move(b);
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_move, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_move, Std_family);
+
+template<typename F>
+static void BM_cmp_weak_lock(benchmark::State& state)
+{
+    auto sp = F::template make_shared<Node>(1);
+    typename F::template weak<Node> wp(sp);
+
+    for(auto _ : state)
+    {
+        auto locked = wp.lock();
+        benchmark::DoNotOptimize(locked.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_weak_lock, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_weak_lock, Std_family);
+
+//reset() of one of two owners, then of the last owner of a new object
+template<typename F>
+static void BM_cmp_reset(benchmark::State& state)
+{
+    auto original = F::template make_shared<Node>(1);
+    typename F::template shared<Node> sp;
+
+    for(auto _ : state)
+    {
+        sp = original;
+        sp.reset();
+        sp.reset(new Node(2));
+        sp.reset();
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_reset, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_reset, Std_family);
+
+template<typename F>
+static void BM_cmp_make_unique(benchmark::State& state)
+{
+    for(auto _ : state)
+    {
+        auto up = F::template make_unique<Node>(1);
+        benchmark::DoNotOptimize(up.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_make_unique, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_make_unique, Std_family);
+
+template<typename F, typename D>
+static void unique_with_deleter(benchmark::State& state, D deleter)
+{
+    for(auto _ : state)
+    {
+        typename F::template unique<Node, D> up(new Node(1), deleter);
+        benchmark::DoNotOptimize(up.get());
+    }
+}
+
+template<typename F>
+static void BM_cmp_unique_stateful_deleter(benchmark::State& state)
+{
+    long deletes = 0;
+    unique_with_deleter<F>(state, Stateful_delete{&deletes});
+}
+BENCHMARK_TEMPLATE(BM_cmp_unique_stateful_deleter, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_unique_stateful_deleter, Std_family);
+
+template<typename F>
+static void BM_cmp_unique_function_deleter(benchmark::State& state)
+{
+    unique_with_deleter<F>(state, &delete_node);
+}
+BENCHMARK_TEMPLATE(BM_cmp_unique_function_deleter, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_unique_function_deleter, Std_family);
+
+template<typename F>
+struct Family_esft_node : F::template from_this<Family_esft_node<F>>
+{
+    long value = 1;
+};
+
+template<typename F>
+static void BM_cmp_shared_from_this(benchmark::State& state)
+{
+    auto sp = F::template make_shared<Family_esft_node<F>>();
+
+    for(auto _ : state)
+    {
+        auto self = sp->shared_from_this();
+        benchmark::DoNotOptimize(self.get());
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_shared_from_this, Tuz_family);
+BENCHMARK_TEMPLATE(BM_cmp_shared_from_this, Std_family);
+
+//containers: filling a vector with copies, sorting handles by the value
+//they point at, and inserting into and erasing from a map
+template<typename F>
+static void BM_cmp_vector_fill(benchmark::State& state)
+{
+    auto node = F::template make_shared<Node>(1);
+    std::vector<typename F::template shared<Node>> v;
+
+    for(auto _ : state)
+    {
+        for(long i = 0; i < state.range(0); ++i)
+            v.push_back(node);
+
+        v.clear();
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_cmp_vector_fill, Tuz_family)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_cmp_vector_fill, Std_family)->Arg(1024);
+
+template<typename F>
+static void BM_cmp_sort(benchmark::State& state)
+{
+    std::vector<typename F::template shared<Node>> v;
+    std::mt19937 random(228);
+
+    for(long i = 0; i < state.range(0); ++i)
+        v.push_back(F::template make_shared<Node>(long(random())));
+
+    for(auto _ : state)
+    {
+        state.PauseTiming();
+        std::shuffle(v.begin(), v.end(), random);
+        state.ResumeTiming();
+
+        std::sort(v.begin(), v.end(), [](const auto& a, const auto& b)
+        {
+            return a->value < b->value;
+        });
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_cmp_sort, Tuz_family)->Arg(4096);
+BENCHMARK_TEMPLATE(BM_cmp_sort, Std_family)->Arg(4096);
+
+template<typename F>
+static void BM_cmp_map_churn(benchmark::State& state)
+{
+    std::map<long, typename F::template shared<Node>> m;
+    long i = 0;
+
+    for(auto _ : state)
+    {
+        m.emplace(i, F::template make_shared<Node>(i));
+
+        if(long(m.size()) > state.range(0))
+            m.erase(m.begin());
+
+        ++i;
+    }
+}
+BENCHMARK_TEMPLATE(BM_cmp_map_churn, Tuz_family)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_cmp_map_churn, Std_family)->Arg(1024);
+
+//the results also go to benchmarks.json unless --benchmark_out names
+//another file, so every build leaves a report to compare against
+int main(int argc, char** argv)
+{
+    std::vector<char*> args(argv, argv + argc);
+    char out[] = "--benchmark_out=benchmarks.json";
+    char format[] = "--benchmark_out_format=json";
+
+    if(std::none_of(args.begin() + 1, args.end(), [](const char* arg)
+    {
+        return std::string(arg).rfind("--benchmark_out=", 0) == 0;
+    }))
+    {
+        args.push_back(out);
+        args.push_back(format);
+    }
+
+    int count = int(args.size());
+
+    benchmark::Initialize(&count, args.data());
+
+    if(benchmark::ReportUnrecognizedArguments(count, args.data()))
+        return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return 0;
+}
@@ -0,0 +1,342 @@
+#ifndef BIASED_H_INCLUDED
+#define BIASED_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "counter.h"
+
+namespace tuz
+{
+
+class Proxy_base;
+
+//Every thread that creates proxies under TUZ_BIASED_REFCOUNT gets an owner
+//record with a queue of proxies whose shared count went negative on other
+//threads. The owner merges its biased count into them when it drains the
+//queue: whenever it creates a proxy, when it drops a link to a queued
+//proxy, when it calls drain_biased_queue() and when it exits. Proxies keep pointing at the record after the thread
+//has exited, so records are never freed; a dead record refuses pushes and
+//the pushing thread merges the proxy itself.
+//push() and merge_all() need Proxy_base and are defined in proxy.h.
+class Biased_owner
+{
+private:
+    struct Thread_state
+    {
+        Biased_owner* owner;
+        bool exited;
+    };
+
+    struct Thread_guard
+    {
+        ~Thread_guard();
+    };
+
+    std::atomic<Proxy_base*> queue{nullptr};
+    Biased_owner* next_owner = nullptr;
+
+    Biased_owner() = default;
+    Biased_owner(const Biased_owner&) = delete;
+    Biased_owner& operator=(const Biased_owner&) = delete;
+
+    static std::atomic<Biased_owner*>& all_owners() noexcept;
+    static Thread_state& state() noexcept;
+    static Proxy_base* dead() noexcept;
+    static void merge_all(Proxy_base* list) noexcept;
+
+public:
+    //null for threads that haven't created a proxy yet or have exited
+    static Biased_owner* current() noexcept;
+    //null once the thread has exited or when the record can't be allocated
+    static Biased_owner* acquire() noexcept;
+
+    //false when the owner has exited
+    bool push(Proxy_base* proxy) noexcept;
+    void drain() noexcept;
+};
+
+//The owning thread counts its links in biased with plain loads and stores,
+//other threads count theirs in shared, which goes negative when they drop
+//links the owner made. The thread that takes it below zero sets queued,
+//adds a link on behalf of the queue and queues the proxy to its owner.
+//Merging adds biased into shared, drops the queue's link and clears queued;
+//once merged is set shared alone is the count. The owner merges on its own
+//when its biased count drops to zero.
+//Only the biased half saturates, shared has 30 bits for the other threads.
+class biased_counter
+{
+private:
+    static constexpr uint32_t merged = 1;
+    static constexpr uint32_t queued = 2;
+    static constexpr uint32_t one = 4;
+
+    std::atomic<Biased_owner*> owner;
+    std::atomic<uint32_t> biased;
+    //(signed count << 2) | queued | merged
+    std::atomic<uint32_t> shared;
+
+    biased_counter(const biased_counter&) = delete;
+    biased_counter& operator=(const biased_counter&) = delete;
+
+    static int32_t count_of(uint32_t word) noexcept;
+    int64_t links_of(uint32_t word) const noexcept;
+    bool owned() const noexcept;
+    size_t release(int64_t links) noexcept;
+
+public:
+    explicit biased_counter(size_t value = 0) noexcept;
+
+    void increment(size_t links = 1) noexcept;
+    //enqueue is set when the caller has to queue the proxy to its owner.
+    //The owner drains its queue when it finds the proxy queued, which may
+    //free the proxy: the caller must not touch it after a nonzero result.
+    size_t decrement(size_t links, bool& enqueue) noexcept;
+    bool increment_if_not_zero() noexcept;
+    size_t load() const noexcept;
+
+    //called for a queued proxy by its owner, or by anyone once the owner
+    //has exited; returns the links left like decrement
+    size_t merge() noexcept;
+    Biased_owner* get_owner() const noexcept;
+};
+
+//every record ever made, so none of them looks leaked
+inline std::atomic<Biased_owner*>& Biased_owner::all_owners() noexcept
+{
+    static std::atomic<Biased_owner*> the_list{nullptr};
+    return the_list;
+}
+
+//trivially destructible, so it stays usable after Thread_guard has run
+inline Biased_owner::Thread_state& Biased_owner::state() noexcept
+{
+    static thread_local Thread_state the_state;
+    return the_state;
+}
+
+inline Proxy_base* Biased_owner::dead() noexcept
+{
+    return reinterpret_cast<Proxy_base*>(uintptr_t(1));
+}
+
+inline Biased_owner* Biased_owner::current() noexcept
+{
+    return state().owner;
+}
+
+inline Biased_owner* Biased_owner::acquire() noexcept
+{
+    Thread_state& s = state();
+
+    if(s.owner)
+    {
+        if(s.owner->queue.load(std::memory_order_relaxed))
+            s.owner->drain();
+
+        return s.owner;
+    }
+
+    if(s.exited)
+        return nullptr;
+
+    static thread_local Thread_guard the_guard;
+    (void)the_guard;
+
+    s.owner = new(std::nothrow) Biased_owner;
+
+    if(s.owner)
+    {
+        s.owner->next_owner = all_owners().load(std::memory_order_relaxed);
+
+        while(!all_owners().compare_exchange_weak(s.owner->next_owner, s.owner, std::memory_order_relaxed))
+            ;
+    }
+
+    return s.owner;
+}
+
+//the thread counts like any other non-owner from here on, so whatever it
+//releases later is queued to the record or merged on the spot
+inline Biased_owner::Thread_guard::~Thread_guard()
+{
+    Thread_state& s = state();
+    Biased_owner* owner = s.owner;
+
+    s.owner = nullptr;
+    s.exited = true;
+
+    if(owner)
+        merge_all(owner->queue.exchange(dead(), std::memory_order_acq_rel));
+}
+
+inline void Biased_owner::drain() noexcept
+{
+    merge_all(queue.exchange(nullptr, std::memory_order_acquire));
+}
+
+inline int32_t biased_counter::count_of(uint32_t word) noexcept
+{
+    return int32_t(word) >> 2;
+}
+
+//the links held by handles, without the one held by the queue; biased may
+//be stale when read by another thread
+inline int64_t biased_counter::links_of(uint32_t word) const noexcept
+{
+    int64_t links = int64_t(count_of(word)) - ((word & queued) ? 1 : 0);
+
+    if(!(word & merged))
+        links += biased.load(std::memory_order_relaxed);
+
+    return links;
+}
+
+//without an owner the counter starts merged and works like atomic_counter
+inline biased_counter::biased_counter(size_t value) noexcept :
+owner(Biased_owner::acquire()), biased(0), shared(merged)
+{
+    if(owner.load(std::memory_order_relaxed))
+    {
+        biased.store(value, std::memory_order_relaxed);
+        shared.store(0, std::memory_order_relaxed);
+    }
+    else
+        shared.store(value * one | merged, std::memory_order_relaxed);
+}
+
+inline bool biased_counter::owned() const noexcept
+{
+    Biased_owner* o = owner.load(std::memory_order_relaxed);
+
+    return o && o == Biased_owner::current();
+}
+
+//a null owner is published after merged, so whoever reads it sees merged
+inline Biased_owner* biased_counter::get_owner() const noexcept
+{
+    return owner.load(std::memory_order_acquire);
+}
+
+inline void biased_counter::increment(size_t links) noexcept
+{
+    if(owned())
+    {
+        uint32_t b = biased.load(std::memory_order_relaxed);
+
+        biased.store(b >= max_links - links ? saturated_links : b + links, std::memory_order_relaxed);
+    }
+    else
+        shared.fetch_add(links * one, std::memory_order_relaxed);
+}
+
+//the last release acquires every release made by the other threads
+inline size_t biased_counter::release(int64_t links) noexcept
+{
+    if(links)
+        return links;
+
+    shared.load(std::memory_order_acquire);
+    return 0;
+}
+
+inline size_t biased_counter::decrement(size_t links, bool& enqueue) noexcept
+{
+    if(owned())
+    {
+        uint32_t b = biased.load(std::memory_order_relaxed);
+
+        if(b >= max_links)
+            return saturated_links;
+
+        if(b != links)
+        {
+            biased.store(b - links, std::memory_order_relaxed);
+
+            //other threads may have left us holding the last links
+            if(shared.load(std::memory_order_relaxed) & queued)
+                Biased_owner::current()->drain();
+
+            return b - links;
+        }
+
+        //the owner holds nothing any more, so shared can't be negative
+        biased.store(0, std::memory_order_relaxed);
+
+        uint32_t old = shared.fetch_or(merged, std::memory_order_acq_rel);
+
+        owner.store(nullptr, std::memory_order_release);
+
+        return count_of(old);
+    }
+
+    uint32_t old = shared.load(std::memory_order_relaxed);
+    uint32_t fresh;
+
+    do
+    {
+        fresh = old - links * one;
+
+        if(!(old & (merged | queued)) && count_of(fresh) < 0)
+            fresh += one + queued;
+    }
+    while(!shared.compare_exchange_weak(old, fresh, std::memory_order_release, std::memory_order_relaxed));
+
+    if(old & merged)
+        return release(count_of(fresh));
+
+    enqueue = (fresh & queued) && !(old & queued);
+
+    return 1;
+}
+
+//a merge to zero sets merged and makes the exchange fail
+inline bool biased_counter::increment_if_not_zero() noexcept
+{
+    if(owned())
+    {
+        increment();
+        return true;
+    }
+
+    uint32_t old = shared.load(std::memory_order_relaxed);
+
+    do
+        if(links_of(old) <= 0)
+            return false;
+    while(!shared.compare_exchange_weak(old, old + one, std::memory_order_relaxed));
+
+    return true;
+}
+
+inline size_t biased_counter::load() const noexcept
+{
+    int64_t links = links_of(shared.load(std::memory_order_relaxed));
+
+    return links > 0 ? links : 0;
+}
+
+inline size_t biased_counter::merge() noexcept
+{
+    uint32_t old = shared.load(std::memory_order_relaxed);
+
+    if(old & merged)
+    {
+        old = shared.fetch_sub(one + queued, std::memory_order_acq_rel);
+        return release(count_of(old) - 1);
+    }
+
+    uint32_t b = biased.load(std::memory_order_relaxed);
+
+    biased.store(0, std::memory_order_relaxed);
+    old = shared.fetch_add(b * one - one - queued + merged, std::memory_order_acq_rel);
+    owner.store(nullptr, std::memory_order_release);
+
+    return count_of(old) + int64_t(b) - 1;
+}
+
+}
+
+#endif // BIASED_H_INCLUDED
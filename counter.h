@@ -0,0 +1,189 @@
+#ifndef COUNTER_H_INCLUDED
+#define COUNTER_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//ThreadSanitizer doesn't model fences, so under it the decrement that
+//reaches zero acquires by itself
+#if defined(__SANITIZE_THREAD__)
+#define TUZ_THREAD_SANITIZER
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define TUZ_THREAD_SANITIZER
+#endif
+#endif
+
+namespace tuz
+{
+
+//Counters are 32-bit. A count that reaches max_links is pinned at
+//saturated_links and never changes again: the object leaks instead of
+//being freed while links to it still exist. The gap above max_links
+//absorbs increments racing with the one that saturates.
+constexpr uint32_t max_links = uint32_t(1) << 31;
+constexpr uint32_t saturated_links = max_links | (max_links >> 1);
+
+class single_threaded_counter
+{
+private:
+    uint32_t value;
+
+    single_threaded_counter(const single_threaded_counter&) = delete;
+    single_threaded_counter& operator=(const single_threaded_counter&) = delete;
+
+public:
+    explicit single_threaded_counter(size_t value = 0) noexcept : value(value) {};
+
+    void increment(size_t links = 1) noexcept;
+    size_t decrement(size_t links = 1) noexcept;
+    bool increment_if_not_zero() noexcept;
+    size_t load() const noexcept;
+
+    void increment_local(size_t links = 1) noexcept;
+    size_t decrement_local(size_t links = 1) noexcept;
+};
+
+inline void single_threaded_counter::increment(size_t links) noexcept
+{
+    if(value >= max_links - links)
+        value = saturated_links;
+    else
+        value += links;
+}
+
+inline size_t single_threaded_counter::decrement(size_t links) noexcept
+{
+    if(value >= max_links)
+        return saturated_links;
+
+    return value -= links;
+}
+
+inline bool single_threaded_counter::increment_if_not_zero() noexcept
+{
+    if(!value)
+        return false;
+
+    increment();
+    return true;
+}
+
+inline size_t single_threaded_counter::load() const noexcept
+{
+    return value;
+}
+
+inline void single_threaded_counter::increment_local(size_t links) noexcept
+{
+    increment(links);
+}
+
+inline size_t single_threaded_counter::decrement_local(size_t links) noexcept
+{
+    return decrement(links);
+}
+
+//Increments are relaxed: a new link can only be made from an existing one,
+//which already keeps the object alive. The decrement that reaches zero
+//acquires every release made by the other owners before deletion.
+class atomic_counter
+{
+private:
+    std::atomic<uint32_t> value;
+
+    atomic_counter(const atomic_counter&) = delete;
+    atomic_counter& operator=(const atomic_counter&) = delete;
+
+public:
+    explicit atomic_counter(size_t value = 0) noexcept : value(value) {};
+
+    void increment(size_t links = 1) noexcept;
+    size_t decrement(size_t links = 1) noexcept;
+    bool increment_if_not_zero() noexcept;
+    size_t load() const noexcept;
+
+    //for counters that only one thread touches: a plain load and store
+    //instead of a locked read-modify-write
+    void increment_local(size_t links = 1) noexcept;
+    size_t decrement_local(size_t links = 1) noexcept;
+};
+
+inline void atomic_counter::increment(size_t links) noexcept
+{
+    if(value.fetch_add(links, std::memory_order_relaxed) >= max_links - links)
+        value.store(saturated_links, std::memory_order_relaxed);
+}
+
+inline size_t atomic_counter::decrement(size_t links) noexcept
+{
+#ifdef TUZ_THREAD_SANITIZER
+    uint32_t old = value.fetch_sub(links, std::memory_order_acq_rel);
+#else
+    uint32_t old = value.fetch_sub(links, std::memory_order_release);
+#endif
+
+    if(old >= max_links)
+    {
+        value.store(saturated_links, std::memory_order_relaxed);
+        return saturated_links;
+    }
+
+#ifndef TUZ_THREAD_SANITIZER
+    if(old == links)
+        std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+
+    return old - links;
+}
+
+inline bool atomic_counter::increment_if_not_zero() noexcept
+{
+    uint32_t current = value.load(std::memory_order_relaxed);
+
+    while(current)
+    {
+        if(current >= max_links)
+            return true;
+
+        if(value.compare_exchange_weak(current, current + 1, std::memory_order_relaxed))
+            return true;
+    }
+
+    return false;
+}
+
+inline size_t atomic_counter::load() const noexcept
+{
+    return value.load(std::memory_order_relaxed);
+}
+
+inline void atomic_counter::increment_local(size_t links) noexcept
+{
+    uint32_t old = value.load(std::memory_order_relaxed);
+
+    value.store(old >= max_links - links ? saturated_links : old + links, std::memory_order_relaxed);
+}
+
+inline size_t atomic_counter::decrement_local(size_t links) noexcept
+{
+    uint32_t old = value.load(std::memory_order_relaxed);
+
+    if(old >= max_links)
+        return saturated_links;
+
+    value.store(old - links, std::memory_order_relaxed);
+
+    return old - links;
+}
+
+#ifdef TUZ_SINGLE_THREADED
+typedef single_threaded_counter default_counter;
+#else
+typedef atomic_counter default_counter;
+#endif
+
+}
+
+#endif // COUNTER_H_INCLUDED
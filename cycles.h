@@ -0,0 +1,553 @@
+#ifndef CYCLES_H_INCLUDED
+#define CYCLES_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "smart_ptr.h"
+
+namespace tuz
+{
+
+template<typename T, typename... R>
+Enable_if_not_array<T, shared_ptr<T>> make_shared_collectable(R&&... args);
+
+struct cycle_stats
+{
+    size_t collections;         //calls of collect_cycles()
+    size_t reclaimed_objects;
+    size_t reclaimed_bytes;     //objects and their proxies
+    size_t last_reclaimed_bytes;//by the last call
+    size_t pending_roots;       //possible roots not examined yet, or in the collection in progress
+};
+
+//T::trace(cycle_tracer& tracer) const hands every shared_ptr member to the
+//tracer. Edges to objects that don't come from make_shared_collectable
+//are skipped, so a cycle is only found when all of its objects do.
+class cycle_tracer
+{
+    friend class Cycle_collector;
+
+private:
+    std::vector<Collectable_proxy*>& edges;
+
+    explicit cycle_tracer(std::vector<Collectable_proxy*>& edges) noexcept : edges(edges) {};
+
+public:
+    template<typename U>
+    void operator()(const shared_ptr<U>& sp);
+};
+
+//Trial deletion after Bacon and Rajan. Every object that loses a link is a
+//possible root of a garbage cycle. For the subgraph reachable from the
+//roots the collector subtracts the links inside the subgraph from the
+//counts; objects left with links are held from outside, and so is
+//everything they reach. The rest is garbage held only by itself.
+//A collection is split into calls of collect_cycles(), each of which
+//traces at most max_visits objects, and the program runs in between. The
+//collector holds a weak link on every object it has colored, so none is
+//freed under it. Counts seen in earlier calls may be stale, so the garbage
+//found from each root is counted again when it is complete; whatever is
+//linked from outside it, and everything that reaches, is kept.
+//Garbage is destroyed with one temporary link on every object, so its
+//links to the other garbage never reach zero and no destructor runs twice.
+class Cycle_collector
+{
+private:
+    typedef Collectable_proxy::Color Color;
+
+    enum class Phase
+    {
+        idle,
+        mark,
+        scan,
+        collect,
+        release
+    };
+
+    std::mutex mutex;
+    cycle_stats stats{};
+
+    Phase phase = Phase::idle;
+    //the roots of the collection in progress, the next one for the phase
+    std::vector<Collectable_proxy*> roots;
+    size_t root_index = 0;
+    //every object colored by the collection, each with a weak link of the
+    //collector; the roots keep the one they were buffered with
+    std::vector<Collectable_proxy*> reached;
+    //visits left in this call
+    size_t budget = 0;
+
+    std::vector<Collectable_proxy*> stack, black, garbage, edges;
+
+    Cycle_collector() = default;
+    Cycle_collector(const Cycle_collector&) = delete;
+    Cycle_collector& operator=(const Cycle_collector&) = delete;
+
+    void trace(Collectable_proxy* proxy);
+    void paint_gray(Collectable_proxy* proxy);
+    bool start();
+    bool mark();
+    bool scan();
+    bool collect_white(size_t& bytes);
+    size_t free_garbage();
+    bool release();
+    static void release_root(Collectable_proxy* root) noexcept;
+
+public:
+    static Cycle_collector& instance();
+
+    size_t collect(size_t max_visits);
+    cycle_stats get_stats();
+};
+
+template<typename U>
+void cycle_tracer::operator()(const shared_ptr<U>& sp)
+{
+    Proxy_base* proxy = sp.proxy;
+
+    if(proxy && proxy->managed_by(&Collectable_proxy::manage))
+        edges.push_back(static_cast<Collectable_proxy*>(proxy));
+}
+
+inline Cycle_collector& Cycle_collector::instance()
+{
+    static Cycle_collector* the_collector = new Cycle_collector;
+    return *the_collector;
+}
+
+//leaves the edges of proxy in edges
+inline void Cycle_collector::trace(Collectable_proxy* proxy)
+{
+    cycle_tracer tracer(edges);
+
+    if(budget)
+        --budget;
+
+    edges.clear();
+    proxy->ops->trace(proxy, tracer);
+}
+
+inline void Cycle_collector::paint_gray(Collectable_proxy* proxy)
+{
+    if(proxy->color == Color::black)
+    {
+        proxy->check_in(Identity<weak_ptr<Collectable_proxy>>());
+        reached.push_back(proxy);
+    }
+
+    proxy->color = Color::gray;
+    proxy->trial = proxy->links_count();
+}
+
+//the whole stack of possible roots at once, without walking it under a CAS
+inline bool Cycle_collector::start()
+{
+    Collectable_proxy* next = Collectable_proxy::possible_roots().exchange(nullptr, std::memory_order_acquire);
+
+    while(next)
+    {
+        Collectable_proxy* root = next;
+
+        next = root->next_root;
+        Collectable_proxy::possible_roots_count().fetch_sub(1, std::memory_order_relaxed);
+        //from now on a lost link queues the object again
+        root->buffered.store(false, std::memory_order_relaxed);
+        roots.push_back(root);
+        reached.push_back(root);
+    }
+
+    root_index = 0;
+
+    return !roots.empty();
+}
+
+//each phase returns true once it is done, false when the budget runs out;
+//everything left on the stacks between calls has a link of the collector
+inline bool Cycle_collector::mark()
+{
+    while(budget)
+    {
+        if(stack.empty())
+        {
+            if(root_index == roots.size())
+                return true;
+
+            Collectable_proxy* root = roots[root_index++];
+
+            if(!root->expired() && root->color != Color::gray)
+            {
+                paint_gray(root);
+                stack.push_back(root);
+            }
+
+            continue;
+        }
+
+        Collectable_proxy* proxy = stack.back();
+        stack.pop_back();
+
+        if(proxy->expired())
+            continue;
+
+        trace(proxy);
+
+        for(Collectable_proxy* edge : edges)
+        {
+            if(edge->color != Color::gray)
+            {
+                paint_gray(edge);
+                stack.push_back(edge);
+            }
+
+            --edge->trial;
+        }
+    }
+
+    return false;
+}
+
+//the trial counts are scratch, so unlike the original nothing is restored;
+//objects held from outside are painted black from their own stack first
+inline bool Cycle_collector::scan()
+{
+    while(budget)
+    {
+        if(!black.empty())
+        {
+            Collectable_proxy* proxy = black.back();
+            black.pop_back();
+
+            if(proxy->expired())
+                continue;
+
+            trace(proxy);
+
+            for(Collectable_proxy* edge : edges)
+                if(edge->color != Color::black)
+                {
+                    edge->color = Color::black;
+                    black.push_back(edge);
+                }
+
+            continue;
+        }
+
+        if(stack.empty())
+        {
+            if(root_index == roots.size())
+                return true;
+
+            stack.push_back(roots[root_index++]);
+            continue;
+        }
+
+        Collectable_proxy* proxy = stack.back();
+        stack.pop_back();
+
+        if(proxy->color != Color::gray)
+            continue;
+
+        if(proxy->expired() || proxy->trial > 0)
+        {
+            proxy->color = Color::black;
+            black.push_back(proxy);
+            continue;
+        }
+
+        proxy->color = Color::white;
+        trace(proxy);
+
+        for(Collectable_proxy* edge : edges)
+            if(edge->color == Color::gray)
+                stack.push_back(edge);
+    }
+
+    return false;
+}
+
+//the white objects reachable from one root are freed together once they
+//are all found, the garbage of later roots may still be incomplete
+inline bool Cycle_collector::collect_white(size_t& bytes)
+{
+    while(budget)
+    {
+        if(stack.empty())
+        {
+            if(!garbage.empty())
+                bytes += free_garbage();
+
+            if(root_index == roots.size())
+                return true;
+
+            stack.push_back(roots[root_index++]);
+            continue;
+        }
+
+        Collectable_proxy* proxy = stack.back();
+        stack.pop_back();
+
+        if(proxy->color != Color::white)
+            continue;
+
+        if(proxy->expired())
+        {
+            proxy->color = Color::black;
+            continue;
+        }
+
+        proxy->color = Color::orange;
+        garbage.push_back(proxy);
+        trace(proxy);
+
+        for(Collectable_proxy* edge : edges)
+            if(edge->color == Color::white)
+                stack.push_back(edge);
+    }
+
+    return false;
+}
+
+//The garbage may have been found over several calls, and the program may
+//have linked to it meanwhile. Its links are counted again: an object with
+//more links than the garbage gives it is held from outside, and so is all
+//the garbage it reaches. Returns the bytes freed.
+inline size_t Cycle_collector::free_garbage()
+{
+    for(Collectable_proxy* proxy : garbage)
+        if(proxy->expired())
+            proxy->color = Color::black;
+        else
+            proxy->trial = proxy->links_count();
+
+    for(Collectable_proxy* proxy : garbage)
+        if(proxy->color == Color::orange)
+        {
+            trace(proxy);
+
+            for(Collectable_proxy* edge : edges)
+                if(edge->color == Color::orange)
+                    --edge->trial;
+        }
+
+    for(Collectable_proxy* proxy : garbage)
+        if(proxy->color == Color::orange && proxy->trial > 0)
+        {
+            proxy->color = Color::black;
+            black.push_back(proxy);
+
+            while(!black.empty())
+            {
+                Collectable_proxy* held = black.back();
+                black.pop_back();
+
+                trace(held);
+
+                for(Collectable_proxy* edge : edges)
+                    if(edge->color == Color::orange)
+                    {
+                        edge->color = Color::black;
+                        black.push_back(edge);
+                    }
+            }
+        }
+
+    size_t bytes = 0, objects = 0;
+
+    //keeps the garbage off the stack of possible roots
+    for(Collectable_proxy* proxy : garbage)
+        if(proxy->color == Color::orange)
+        {
+            proxy->check_in(Identity<shared_ptr<Collectable_proxy>>());
+            proxy->buffered.store(true, std::memory_order_relaxed);
+            proxy->disposed = true;
+            bytes += proxy->ops->bytes;
+            ++objects;
+        }
+
+    for(Collectable_proxy* proxy : garbage)
+        if(proxy->color == Color::orange)
+            proxy->ops->manage(proxy, Proxy_op::dispose);
+
+    //the weak links of the collector keep the proxies until release()
+    for(Collectable_proxy* proxy : garbage)
+        if(proxy->color == Color::orange)
+        {
+            proxy->color = Color::black;
+
+            if(proxy->check_out(Identity<shared_ptr<Collectable_proxy>>()))
+                proxy->destroy();
+        }
+
+    garbage.clear();
+    stats.reclaimed_objects += objects;
+
+    return bytes;
+}
+
+//every object the collection colored is black again once its link goes
+inline bool Cycle_collector::release()
+{
+    while(budget && !reached.empty())
+    {
+        Collectable_proxy* proxy = reached.back();
+        reached.pop_back();
+
+        proxy->color = Color::black;
+        release_root(proxy);
+        --budget;
+    }
+
+    if(!reached.empty())
+        return false;
+
+    roots.clear();
+
+    return true;
+}
+
+inline void Cycle_collector::release_root(Collectable_proxy* root) noexcept
+{
+    if(root->check_out(Identity<weak_ptr<Collectable_proxy>>()))
+        root->destroy();
+}
+
+//returns the bytes reclaimed by this call; a call starts at most one
+//collection, with the roots buffered until then
+inline size_t Cycle_collector::collect(size_t max_visits)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    size_t bytes = 0;
+
+    budget = max_visits ? max_visits : 1;
+
+    if(phase == Phase::idle && start())
+        phase = Phase::mark;
+
+    while(phase != Phase::idle && budget)
+        switch(phase)
+        {
+        case Phase::mark:
+            if(mark())
+            {
+                phase = Phase::scan;
+                root_index = 0;
+            }
+            break;
+        case Phase::scan:
+            if(scan())
+            {
+                phase = Phase::collect;
+                root_index = 0;
+            }
+            break;
+        case Phase::collect:
+            if(collect_white(bytes))
+                phase = Phase::release;
+            break;
+        case Phase::release:
+            if(release())
+                phase = Phase::idle;
+            break;
+        case Phase::idle:
+            break;
+        }
+
+    ++stats.collections;
+    stats.reclaimed_bytes += bytes;
+    stats.last_reclaimed_bytes = bytes;
+
+    return bytes;
+}
+
+inline cycle_stats Cycle_collector::get_stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cycle_stats s = stats;
+
+    s.pending_roots = Collectable_proxy::possible_roots_count().load(std::memory_order_relaxed) + roots.size();
+
+    return s;
+}
+
+//Runs the collection in progress, or starts one, for at most max_visits
+//objects traced; the garbage found last is counted again before it is
+//freed, which may take more. Between calls the program may change the graph
+//at will. While a call runs, the objects it may reach must be left alone by
+//other threads: it reads their shared_ptr members through trace(), and a
+//weak_ptr locked meanwhile could revive garbage that was already counted.
+inline size_t collect_cycles(size_t max_visits = SIZE_MAX)
+{
+    return Cycle_collector::instance().collect(max_visits);
+}
+
+inline cycle_stats get_cycle_stats()
+{
+    return Cycle_collector::instance().get_stats();
+}
+
+template<typename T>
+class Collectable_make_proxy : public Collectable_proxy
+{
+private:
+    alignas(T) unsigned char data[sizeof(T)];
+
+    static const Ops the_ops;
+
+    static void manage(Proxy_base* proxy, Proxy_op op) noexcept;
+    static void trace(Collectable_proxy* proxy, cycle_tracer& tracer);
+
+public:
+    template<typename... R>
+    Collectable_make_proxy(R&&... args) : Collectable_proxy(&the_ops)
+    {
+        new(get()) T(std::forward<R>(args)...);
+        created<T>(Instrument_event::make_shared_allocation, sizeof(*this));
+    };
+
+    T* get() noexcept
+    {
+        return reinterpret_cast<T*>(data);
+    };
+};
+
+template<typename T>
+const Collectable_proxy::Ops Collectable_make_proxy<T>::the_ops = {&Collectable_make_proxy::manage, &Collectable_make_proxy::trace, sizeof(Collectable_make_proxy)};
+
+template<typename T>
+void Collectable_make_proxy<T>::manage(Proxy_base* proxy, Proxy_op op) noexcept
+{
+    Collectable_make_proxy* self = static_cast<Collectable_make_proxy*>(proxy);
+
+    instrument<T>(op);
+
+    if(op == Proxy_op::dispose)
+    {
+        Destructor_timer<T> timer(sizeof(T));
+        self->get()->~T();
+    }
+    else
+        delete self;
+}
+
+template<typename T>
+void Collectable_make_proxy<T>::trace(Collectable_proxy* proxy, cycle_tracer& tracer)
+{
+    static_cast<const T*>(static_cast<Collectable_make_proxy*>(proxy)->get())->trace(tracer);
+}
+
+template<typename T, typename... R>
+Enable_if_not_array<T, shared_ptr<T>> make_shared_collectable(R&&... args)
+{
+    Collectable_make_proxy<T>* pb = new Collectable_make_proxy<T>(std::forward<R>(args)...);
+
+    return shared_ptr<T>(*pb, pb->get());
+}
+
+}
+
+#endif // CYCLES_H_INCLUDED
@@ -0,0 +1,417 @@
+#ifndef DEFERRED_H_INCLUDED
+#define DEFERRED_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "smart_ptr.h"
+
+namespace tuz
+{
+
+struct deferred_stats
+{
+    size_t queued;          //objects waiting for the reclaimer
+    size_t queued_bytes;    //bytes of the objects waiting, as deferred_size tells them
+    size_t reclaimed;       //objects destroyed from the queue
+    size_t inline_reclaims; //objects destroyed by the releasing thread because the queue was full
+};
+
+//Vyukov's bounded multi-producer multi-consumer queue: every cell carries
+//a sequence number that tells producers and consumers whose turn it is, so
+//a push or a pop is one CAS on a position and one store to the cell.
+template<typename E, size_t Capacity>
+class Bounded_queue
+{
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "the capacity is a power of two");
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        E entry;
+    };
+
+    Cell cells[Capacity];
+    alignas(cache_line_size) std::atomic<size_t> push_position{0};
+    alignas(cache_line_size) std::atomic<size_t> pop_position{0};
+
+    Bounded_queue(const Bounded_queue&) = delete;
+    Bounded_queue& operator=(const Bounded_queue&) = delete;
+
+public:
+    Bounded_queue() noexcept;
+
+    //false when the queue is full
+    bool push(const E& entry) noexcept;
+    //false when the queue is empty
+    bool pop(E& entry) noexcept;
+};
+
+template<typename E, size_t Capacity>
+Bounded_queue<E, Capacity>::Bounded_queue() noexcept
+{
+    for(size_t i = 0; i < Capacity; ++i)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template<typename E, size_t Capacity>
+bool Bounded_queue<E, Capacity>::push(const E& entry) noexcept
+{
+    size_t position = push_position.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    while(true)
+    {
+        cell = &cells[position & (Capacity - 1)];
+        ptrdiff_t lag = ptrdiff_t(cell->sequence.load(std::memory_order_acquire)) - ptrdiff_t(position);
+
+        if(!lag)
+        {
+            if(push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(lag < 0)
+            return false;
+        else
+            position = push_position.load(std::memory_order_relaxed);
+    }
+
+    cell->entry = entry;
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    return true;
+}
+
+template<typename E, size_t Capacity>
+bool Bounded_queue<E, Capacity>::pop(E& entry) noexcept
+{
+    size_t position = pop_position.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    while(true)
+    {
+        cell = &cells[position & (Capacity - 1)];
+        ptrdiff_t lag = ptrdiff_t(cell->sequence.load(std::memory_order_acquire)) - ptrdiff_t(position + 1);
+
+        if(!lag)
+        {
+            if(pop_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(lag < 0)
+            return false;
+        else
+            position = pop_position.load(std::memory_order_relaxed);
+    }
+
+    entry = cell->entry;
+    cell->sequence.store(position + Capacity, std::memory_order_release);
+
+    return true;
+}
+
+typedef void (*Deferred_reclaim)(void* target) noexcept;
+
+//Objects whose last owner is gone wait in a bounded queue until the
+//background thread started with start_deferred_reclaimer() or a call to
+//flush_deferred() at a quiescent point destroys them. When the queue is
+//full the releasing thread destroys the object itself, so a slow reclaimer
+//costs latency instead of memory.
+//The reclaimer is never destroyed: objects may be released during static
+//destruction. Call stop_deferred_reclaimer() at shutdown to destroy what
+//is still queued.
+class Deferred_reclaimer
+{
+private:
+    struct Entry
+    {
+        void* target;
+        Deferred_reclaim reclaim;
+        size_t bytes;
+    };
+
+    static constexpr size_t capacity = 4096;
+
+    Bounded_queue<Entry, capacity> queue;
+
+    std::atomic<size_t> queued{0}, queued_bytes{0}, reclaimed{0}, inline_reclaims{0};
+
+    //only for sleeping, the queue itself takes no lock
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::atomic<bool> sleeping{false};
+    bool stopping = false;
+    std::thread worker;
+
+    Deferred_reclaimer() = default;
+    Deferred_reclaimer(const Deferred_reclaimer&) = delete;
+    Deferred_reclaimer& operator=(const Deferred_reclaimer&) = delete;
+
+    bool reclaim_one() noexcept;
+    void run() noexcept;
+
+public:
+    static Deferred_reclaimer& instance();
+
+    void defer(void* target, Deferred_reclaim reclaim, size_t bytes) noexcept;
+    size_t flush() noexcept;
+    void start();
+    void stop() noexcept;
+    deferred_stats stats() const noexcept;
+};
+
+inline Deferred_reclaimer& Deferred_reclaimer::instance()
+{
+    static Deferred_reclaimer* the_reclaimer = new Deferred_reclaimer;
+    return *the_reclaimer;
+}
+
+inline bool Deferred_reclaimer::reclaim_one() noexcept
+{
+    Entry entry;
+
+    if(!queue.pop(entry))
+        return false;
+
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    queued_bytes.fetch_sub(entry.bytes, std::memory_order_relaxed);
+
+    entry.reclaim(entry.target);
+
+    reclaimed.fetch_add(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+inline void Deferred_reclaimer::defer(void* target, Deferred_reclaim reclaim, size_t bytes) noexcept
+{
+    queued.fetch_add(1, std::memory_order_relaxed);
+    queued_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    if(!queue.push(Entry{target, reclaim, bytes}))
+    {
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        queued_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        inline_reclaims.fetch_add(1, std::memory_order_relaxed);
+
+        reclaim(target);
+        return;
+    }
+
+    //pairs with the fence in run(): either we see the worker asleep, or it
+    //sees our entry before it goes to sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if(sleeping.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeup.notify_one();
+    }
+}
+
+//returns the number of objects destroyed by this call
+inline size_t Deferred_reclaimer::flush() noexcept
+{
+    size_t count = 0;
+
+    while(reclaim_one())
+        ++count;
+
+    return count;
+}
+
+inline void Deferred_reclaimer::run() noexcept
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while(true)
+    {
+        lock.unlock();
+        flush();
+        lock.lock();
+
+        if(stopping)
+            return;
+
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if(!queued.load(std::memory_order_relaxed))
+            wakeup.wait_for(lock, std::chrono::milliseconds(50));
+
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+inline void Deferred_reclaimer::start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(worker.joinable())
+        return;
+
+    stopping = false;
+    worker = std::thread(&Deferred_reclaimer::run, this);
+}
+
+//joins the background thread and destroys everything still queued
+inline void Deferred_reclaimer::stop() noexcept
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if(worker.joinable())
+    {
+        stopping = true;
+        wakeup.notify_one();
+        lock.unlock();
+        worker.join();
+    }
+    else
+        lock.unlock();
+
+    flush();
+}
+
+inline deferred_stats Deferred_reclaimer::stats() const noexcept
+{
+    deferred_stats stats;
+
+    stats.queued = queued.load(std::memory_order_relaxed);
+    stats.queued_bytes = queued_bytes.load(std::memory_order_relaxed);
+    stats.reclaimed = reclaimed.load(std::memory_order_relaxed);
+    stats.inline_reclaims = inline_reclaims.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+inline void start_deferred_reclaimer()
+{
+    Deferred_reclaimer::instance().start();
+}
+
+inline void stop_deferred_reclaimer() noexcept
+{
+    Deferred_reclaimer::instance().stop();
+}
+
+inline size_t flush_deferred() noexcept
+{
+    return Deferred_reclaimer::instance().flush();
+}
+
+inline deferred_stats get_deferred_stats() noexcept
+{
+    return Deferred_reclaimer::instance().stats();
+}
+
+//the bytes the reclaimer frees with an object, counted in queued_bytes.
+//sizeof(T) misses whatever the object owns elsewhere, so a container can
+//specialize it to report that too; of() runs on the releasing thread.
+template<typename T>
+struct deferred_size
+{
+    static size_t of(const T& object) noexcept
+    {
+        return sizeof(T);
+    };
+};
+
+//a deleter for shared_ptr and unique_ptr that queues the object
+template<typename T>
+struct deferred_delete
+{
+    void operator()(T* ptr) const noexcept;
+
+private:
+    static void reclaim(void* target) noexcept;
+};
+
+template<typename T>
+void deferred_delete<T>::operator()(T* ptr) const noexcept
+{
+    static_assert(sizeof(T) > 0, "can't delete an incomplete type");
+
+    Deferred_reclaimer::instance().defer(const_cast<void*>(static_cast<const void*>(ptr)), &reclaim, deferred_size<T>::of(*ptr));
+}
+
+template<typename T>
+void deferred_delete<T>::reclaim(void* target) noexcept
+{
+    delete static_cast<T*>(target);
+}
+
+//Make_shared_proxy that queues its object instead of destroying it. The
+//queue holds a weak link, so the proxy outlives the object in the queue;
+//weak_ptrs see the object as expired as soon as the last owner is gone.
+template<typename T>
+class Deferred_proxy : public Proxy_base
+{
+private:
+    alignas(T) unsigned char data[sizeof(T)];
+
+    static void manage(Proxy_base* proxy, Proxy_op op) noexcept;
+    static void reclaim(void* target) noexcept;
+
+public:
+    template<typename... R>
+    Deferred_proxy(R&&... args) : Proxy_base(&manage)
+    {
+        new(get()) T(std::forward<R>(args)...);
+        created<T>(Instrument_event::make_shared_allocation, sizeof(*this));
+    };
+
+    T* get() noexcept
+    {
+        return reinterpret_cast<T*>(data);
+    };
+};
+
+template<typename T>
+void Deferred_proxy<T>::manage(Proxy_base* proxy, Proxy_op op) noexcept
+{
+    Deferred_proxy* self = static_cast<Deferred_proxy*>(proxy);
+
+    if(op == Proxy_op::destroy)
+    {
+        instrument<T>(op);
+        delete self;
+        return;
+    }
+
+    self->check_in(Identity<weak_ptr<T>>());
+    Deferred_reclaimer::instance().defer(self, &reclaim, deferred_size<T>::of(*self->get()));
+}
+
+template<typename T>
+void Deferred_proxy<T>::reclaim(void* target) noexcept
+{
+    Deferred_proxy* self = static_cast<Deferred_proxy*>(target);
+
+    {
+        Destructor_timer<T> timer(sizeof(T));
+        self->get()->~T();
+    }
+
+    instrument<T>(Proxy_op::dispose);
+
+    if(self->check_out(Identity<weak_ptr<T>>()))
+        self->destroy();
+}
+
+template<typename T, typename... R>
+Enable_if_not_array<T, shared_ptr<T>> make_shared_deferred(R&&... args)
+{
+    Deferred_proxy<T>* pb = new Deferred_proxy<T>(std::forward<R>(args)...);
+
+    return shared_ptr<T>(*pb, pb->get());
+}
+
+}
+
+#endif // DEFERRED_H_INCLUDED
@@ -6,12 +6,40 @@
 namespace tuz
 {
 
+template<typename T>
+constexpr enable_shared_from_this<T>::enable_shared_from_this() noexcept
+{
+}
+
+template<typename T>
+enable_shared_from_this<T>::enable_shared_from_this(const enable_shared_from_this& esft) noexcept
+{
+}
+
+template<typename T>
+enable_shared_from_this<T>& enable_shared_from_this<T>::operator=(const enable_shared_from_this& esft) noexcept
+{
+    return *this;
+}
+
 template<typename T>
 shared_ptr<T> enable_shared_from_this<T>::shared_from_this() const
 {
     return shared_ptr<T>(wp_helper);
 }
 
+template<typename T>
+shared_ptr<T> enable_shared_from_this<T>::try_shared_from_this() const noexcept
+{
+    return wp_helper.lock();
+}
+
+template<typename T>
+weak_ptr<T> enable_shared_from_this<T>::weak_from_this() const noexcept
+{
+    return wp_helper;
+}
+
 }
 
 
@@ -10,6 +10,11 @@ class bad_weak_ptr : std::exception
 {
 };
 
+//a local_shared_ptr is promoted only while it is the sole owner
+class bad_local_promotion : public std::exception
+{
+};
+
 }
 
 #endif // EXCEPTION_H_INCLUDED
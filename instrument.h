@@ -0,0 +1,211 @@
+#ifndef INSTRUMENT_H_INCLUDED
+#define INSTRUMENT_H_INCLUDED
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <vector>
+#ifdef TUZ_INSTRUMENT
+#include <atomic>
+#endif
+
+#include "utils.h"
+
+namespace tuz
+{
+
+enum class Instrument_event
+{
+    make_shared_allocation, //object and proxy in one block
+    separate_allocation,    //a proxy for an object made elsewhere
+    object_destroyed,
+    proxy_destroyed,
+    shared_check_in,
+    shared_check_out,
+    weak_check_in,
+    weak_check_out,
+    failed_lock,
+    count
+};
+
+struct instrument_counts
+{
+    std::string type;
+    size_t proxies_created;
+    size_t proxies_destroyed;
+    size_t make_shared_allocations;
+    size_t separate_allocations;
+    size_t shared_check_ins;
+    size_t shared_check_outs;
+    size_t weak_check_ins;
+    size_t weak_check_outs;
+    size_t failed_locks;
+    size_t live_objects;
+    size_t peak_live_objects;
+};
+
+#ifdef TUZ_INSTRUMENT
+//Counters of one type, kept in shards so threads that count the same type
+//mostly write different cache lines; a snapshot adds the shards up. Proxies
+//and objects are counted under the type they were made for, links under
+//the type of the handle. Live objects are one counter per type, so that
+//the peak is exact; they change only when objects come and go.
+//Records are never destroyed and are trivially destructible, so handles
+//can still count while static objects are destroyed.
+class Instrument_record
+{
+private:
+    static constexpr size_t shards = 16;
+    static constexpr size_t events = size_t(Instrument_event::count);
+
+    struct alignas(cache_line_size) Shard
+    {
+        std::atomic<size_t> counts[events];
+    };
+
+    const char* signature;
+    Shard shard[shards];
+    std::atomic<ptrdiff_t> live{0}, peak{0};
+    Instrument_record* next = nullptr;
+
+    static std::atomic<Instrument_record*>& all_records() noexcept;
+    static size_t shard_index() noexcept;
+
+    explicit Instrument_record(const char* signature) noexcept;
+
+    size_t total(Instrument_event event) const noexcept;
+
+public:
+    template<typename T>
+    static Instrument_record& of() noexcept;
+
+    void record(Instrument_event event, size_t n) noexcept;
+    instrument_counts snapshot() const;
+
+    static std::vector<instrument_counts> snapshot_all();
+};
+
+inline std::atomic<Instrument_record*>& Instrument_record::all_records() noexcept
+{
+    static std::atomic<Instrument_record*> the_list{nullptr};
+    return the_list;
+}
+
+//threads take the shards in turn
+inline size_t Instrument_record::shard_index() noexcept
+{
+    static std::atomic<size_t> next_index{0};
+    static thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % shards;
+
+    return index;
+}
+
+inline Instrument_record::Instrument_record(const char* signature) noexcept :
+signature(signature)
+{
+    for(Shard& s : shard)
+        for(std::atomic<size_t>& count : s.counts)
+            count.store(0, std::memory_order_relaxed);
+
+    next = all_records().load(std::memory_order_relaxed);
+
+    while(!all_records().compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+        ;
+}
+
+template<typename T>
+Instrument_record& Instrument_record::of() noexcept
+{
+    static Instrument_record the_record(type_signature<T>());
+    return the_record;
+}
+
+inline void Instrument_record::record(Instrument_event event, size_t n) noexcept
+{
+    shard[shard_index()].counts[size_t(event)].fetch_add(n, std::memory_order_relaxed);
+
+    if(event == Instrument_event::make_shared_allocation || event == Instrument_event::separate_allocation)
+    {
+        ptrdiff_t now = live.fetch_add(1, std::memory_order_relaxed) + 1;
+        ptrdiff_t highest = peak.load(std::memory_order_relaxed);
+
+        while(now > highest && !peak.compare_exchange_weak(highest, now, std::memory_order_relaxed))
+            ;
+    }
+    else if(event == Instrument_event::object_destroyed)
+        live.fetch_sub(1, std::memory_order_relaxed);
+}
+
+inline size_t Instrument_record::total(Instrument_event event) const noexcept
+{
+    size_t sum = 0;
+
+    for(const Shard& s : shard)
+        sum += s.counts[size_t(event)].load(std::memory_order_relaxed);
+
+    return sum;
+}
+
+inline instrument_counts Instrument_record::snapshot() const
+{
+    instrument_counts counts;
+    ptrdiff_t live_now = live.load(std::memory_order_relaxed);
+
+    counts.type = type_name(signature);
+    counts.make_shared_allocations = total(Instrument_event::make_shared_allocation);
+    counts.separate_allocations = total(Instrument_event::separate_allocation);
+    counts.proxies_created = counts.make_shared_allocations + counts.separate_allocations;
+    counts.proxies_destroyed = total(Instrument_event::proxy_destroyed);
+    counts.shared_check_ins = total(Instrument_event::shared_check_in);
+    counts.shared_check_outs = total(Instrument_event::shared_check_out);
+    counts.weak_check_ins = total(Instrument_event::weak_check_in);
+    counts.weak_check_outs = total(Instrument_event::weak_check_out);
+    counts.failed_locks = total(Instrument_event::failed_lock);
+    counts.live_objects = live_now > 0 ? live_now : 0;
+    counts.peak_live_objects = peak.load(std::memory_order_relaxed);
+
+    return counts;
+}
+
+inline std::vector<instrument_counts> Instrument_record::snapshot_all()
+{
+    std::vector<instrument_counts> all;
+
+    for(Instrument_record* r = all_records().load(std::memory_order_acquire); r; r = r->next)
+        all.push_back(r->snapshot());
+
+    return all;
+}
+#endif
+
+//the types the library keeps for itself, which aren't counted at all
+template<typename T>
+struct Instrument_skips : std::false_type
+{
+};
+
+//compiles to nothing without TUZ_INSTRUMENT
+template<typename T>
+inline void instrument(Instrument_event event, size_t n = 1) noexcept
+{
+#ifdef TUZ_INSTRUMENT
+    typedef typename std::remove_cv<T>::type U;
+
+    if(!Instrument_skips<U>::value)
+        Instrument_record::of<U>().record(event, n);
+#endif
+}
+
+//one entry for every type counted so far; empty without TUZ_INSTRUMENT
+inline std::vector<instrument_counts> instrument_snapshot()
+{
+#ifdef TUZ_INSTRUMENT
+    return Instrument_record::snapshot_all();
+#else
+    return std::vector<instrument_counts>();
+#endif
+}
+
+}
+
+#endif // INSTRUMENT_H_INCLUDED
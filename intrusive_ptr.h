@@ -0,0 +1,320 @@
+#ifndef INTRUSIVE_PTR_H_INCLUDED
+#define INTRUSIVE_PTR_H_INCLUDED
+
+#include <cstddef>
+#include <utility>
+
+#include "smart_ptr.h"
+#include "counter.h"
+
+namespace tuz
+{
+
+template<typename T>
+class intrusive_ptr;
+
+template<typename T, typename... R>
+intrusive_ptr<T> make_intrusive(R&&... args);
+
+//T derives from intrusive_ref_counter<T> to keep its count inside the object,
+//so there is no proxy and an intrusive_ptr is a single pointer. Policy is one
+//of the counters from counter.h: single_threaded_counter for objects that
+//never leave their thread, atomic_counter otherwise.
+//A copy of the object starts with a fresh count.
+template<typename T, typename Policy = default_counter>
+class intrusive_ref_counter
+{
+    template<typename U, typename P>
+    friend void intrusive_ptr_add_ref(const intrusive_ref_counter<U, P>* p) noexcept;
+    template<typename U, typename P>
+    friend void intrusive_ptr_release(const intrusive_ref_counter<U, P>* p) noexcept;
+
+private:
+    mutable Policy links;
+
+protected:
+    intrusive_ref_counter() noexcept;
+    intrusive_ref_counter(const intrusive_ref_counter& irc) noexcept;
+    ~intrusive_ref_counter() = default;
+
+    intrusive_ref_counter& operator=(const intrusive_ref_counter& irc) noexcept;
+
+public:
+    //the counterpart of shared_from_this(), which works for any live object
+    intrusive_ptr<T> intrusive_from_this() noexcept;
+    intrusive_ptr<const T> intrusive_from_this() const noexcept;
+
+    size_t use_count() const noexcept;
+};
+
+//intrusive_ptr finds these by argument-dependent lookup, so a type with a
+//count of its own can provide them instead of deriving from the counter
+template<typename T, typename P>
+void intrusive_ptr_add_ref(const intrusive_ref_counter<T, P>* p) noexcept;
+template<typename T, typename P>
+void intrusive_ptr_release(const intrusive_ref_counter<T, P>* p) noexcept;
+
+template<typename T>
+class intrusive_ptr
+{
+    template<typename U>
+    friend class intrusive_ptr;
+
+private:
+    T* ptr = nullptr;
+
+public:
+    typedef T element_type;
+
+    constexpr intrusive_ptr() noexcept;
+    constexpr intrusive_ptr(std::nullptr_t) noexcept;
+    //add_ref = false adopts a link taken before, e.g. by detach()
+    explicit intrusive_ptr(T* ptr, bool add_ref = true) noexcept;
+    intrusive_ptr(const intrusive_ptr& ip) noexcept;
+    intrusive_ptr(intrusive_ptr&& ip) noexcept;
+    template<typename U, typename = Enable_if_convertible<U, T>>
+    intrusive_ptr(const intrusive_ptr<U>& ip) noexcept;
+    template<typename U, typename = Enable_if_convertible<U, T>>
+    intrusive_ptr(intrusive_ptr<U>&& ip) noexcept;
+    ~intrusive_ptr();
+
+    intrusive_ptr& operator=(const intrusive_ptr& ip) noexcept;
+    intrusive_ptr& operator=(intrusive_ptr&& ip) noexcept;
+
+    void reset(T* ptr = nullptr, bool add_ref = true) noexcept;
+    void swap(intrusive_ptr& ip) noexcept;
+    //gives up the link without releasing it
+    T* detach() noexcept;
+
+    T& operator*() const noexcept;
+    T* operator->() const noexcept;
+    operator bool() const noexcept;
+    T* get() const noexcept;
+
+    bool operator==(const intrusive_ptr& ip) const noexcept;
+    bool operator!=(const intrusive_ptr& ip) const noexcept;
+};
+
+//a shared_ptr whose proxy holds one intrusive link, for code that only
+//takes shared_ptr; the object lives until both kinds of owners are gone
+template<typename T>
+shared_ptr<T> to_shared(const intrusive_ptr<T>& ip);
+
+template<typename T, typename Policy>
+intrusive_ref_counter<T, Policy>::intrusive_ref_counter() noexcept :
+links(0)
+{
+}
+
+template<typename T, typename Policy>
+intrusive_ref_counter<T, Policy>::intrusive_ref_counter(const intrusive_ref_counter& irc) noexcept :
+links(0)
+{
+}
+
+template<typename T, typename Policy>
+intrusive_ref_counter<T, Policy>& intrusive_ref_counter<T, Policy>::operator=(const intrusive_ref_counter& irc) noexcept
+{
+    return *this;
+}
+
+template<typename T, typename Policy>
+intrusive_ptr<T> intrusive_ref_counter<T, Policy>::intrusive_from_this() noexcept
+{
+    return intrusive_ptr<T>(static_cast<T*>(this));
+}
+
+template<typename T, typename Policy>
+intrusive_ptr<const T> intrusive_ref_counter<T, Policy>::intrusive_from_this() const noexcept
+{
+    return intrusive_ptr<const T>(static_cast<const T*>(this));
+}
+
+template<typename T, typename Policy>
+size_t intrusive_ref_counter<T, Policy>::use_count() const noexcept
+{
+    return links.load();
+}
+
+template<typename T, typename P>
+void intrusive_ptr_add_ref(const intrusive_ref_counter<T, P>* p) noexcept
+{
+    p->links.increment();
+}
+
+template<typename T, typename P>
+void intrusive_ptr_release(const intrusive_ref_counter<T, P>* p) noexcept
+{
+    if(!p->links.decrement())
+        delete static_cast<const T*>(p);
+}
+
+template<typename T>
+constexpr intrusive_ptr<T>::intrusive_ptr() noexcept
+{
+}
+
+template<typename T>
+constexpr intrusive_ptr<T>::intrusive_ptr(std::nullptr_t) noexcept
+{
+}
+
+template<typename T>
+intrusive_ptr<T>::intrusive_ptr(T* ptr, bool add_ref) noexcept :
+ptr(ptr)
+{
+    if(ptr && add_ref)
+        intrusive_ptr_add_ref(ptr);
+}
+
+template<typename T>
+intrusive_ptr<T>::intrusive_ptr(const intrusive_ptr& ip) noexcept :
+intrusive_ptr(ip.ptr)
+{
+}
+
+template<typename T>
+intrusive_ptr<T>::intrusive_ptr(intrusive_ptr&& ip) noexcept :
+ptr(ip.ptr)
+{
+    ip.ptr = nullptr;
+}
+
+template<typename T>
+template<typename U, typename>
+intrusive_ptr<T>::intrusive_ptr(const intrusive_ptr<U>& ip) noexcept :
+intrusive_ptr(ip.ptr)
+{
+}
+
+template<typename T>
+template<typename U, typename>
+intrusive_ptr<T>::intrusive_ptr(intrusive_ptr<U>&& ip) noexcept :
+ptr(ip.ptr)
+{
+    ip.ptr = nullptr;
+}
+
+template<typename T>
+intrusive_ptr<T>::~intrusive_ptr()
+{
+    if(ptr)
+        intrusive_ptr_release(ptr);
+}
+
+template<typename T>
+intrusive_ptr<T>& intrusive_ptr<T>::operator=(const intrusive_ptr& ip) noexcept
+{
+    intrusive_ptr<T>(ip).swap(*this);
+    return *this;
+}
+
+template<typename T>
+intrusive_ptr<T>& intrusive_ptr<T>::operator=(intrusive_ptr&& ip) noexcept
+{
+    intrusive_ptr<T>(std::move(ip)).swap(*this);
+    return *this;
+}
+
+template<typename T>
+void intrusive_ptr<T>::reset(T* ptr, bool add_ref) noexcept
+{
+    intrusive_ptr<T>(ptr, add_ref).swap(*this);
+}
+
+template<typename T>
+void intrusive_ptr<T>::swap(intrusive_ptr& ip) noexcept
+{
+    std::swap(ptr, ip.ptr);
+}
+
+template<typename T>
+T* intrusive_ptr<T>::detach() noexcept
+{
+    T* detached = ptr;
+
+    ptr = nullptr;
+
+    return detached;
+}
+
+template<typename T>
+T& intrusive_ptr<T>::operator*() const noexcept
+{
+    return *ptr;
+}
+
+template<typename T>
+T* intrusive_ptr<T>::operator->() const noexcept
+{
+    return ptr;
+}
+
+template<typename T>
+intrusive_ptr<T>::operator bool() const noexcept
+{
+    return ptr != nullptr;
+}
+
+template<typename T>
+T* intrusive_ptr<T>::get() const noexcept
+{
+    return ptr;
+}
+
+template<typename T>
+bool intrusive_ptr<T>::operator==(const intrusive_ptr& ip) const noexcept
+{
+    return ptr == ip.ptr;
+}
+
+template<typename T>
+bool intrusive_ptr<T>::operator!=(const intrusive_ptr& ip) const noexcept
+{
+    return !(*this == ip);
+}
+
+template<typename T, typename... R>
+intrusive_ptr<T> make_intrusive(R&&... args)
+{
+    return intrusive_ptr<T>(new T(std::forward<R>(args)...));
+}
+
+template<typename T>
+class Intrusive_link
+{
+private:
+    intrusive_ptr<T> link;
+
+public:
+    explicit Intrusive_link(const intrusive_ptr<T>& ip) noexcept : link(ip) {};
+
+    void operator()(T* ptr) noexcept
+    {
+        link.reset();
+    };
+};
+
+template<typename T>
+shared_ptr<T> to_shared(const intrusive_ptr<T>& ip)
+{
+    if(!ip)
+        return shared_ptr<T>();
+
+    return shared_ptr<T>(ip.get(), Intrusive_link<T>(ip));
+}
+
+}
+
+namespace std
+{
+
+template<typename T>
+void swap(tuz::intrusive_ptr<T>& ip_a, tuz::intrusive_ptr<T>& ip_b) noexcept
+{
+    ip_a.swap(ip_b);
+}
+
+}
+
+#endif // INTRUSIVE_PTR_H_INCLUDED
@@ -0,0 +1,268 @@
+#ifndef LOCAL_SHARED_PTR_H_INCLUDED
+#define LOCAL_SHARED_PTR_H_INCLUDED
+
+#ifdef DEBUG
+#include <cassert>
+#include <thread>
+#endif
+
+#include "smart_ptr.h"
+#include "exception.h"
+
+namespace tuz
+{
+
+template<typename T, typename... R>
+Enable_if_not_array<T, local_shared_ptr<T>> make_local_shared(R&&... args);
+
+//An owner for object graphs that never leave their thread. It uses the same
+//proxies as shared_ptr, but its links are counted with plain loads and
+//stores. There is no weak_ptr and no conversion from or to shared_ptr: the
+//only way out of the thread is promote(), which hands the last local link
+//to a shared_ptr. From then on the proxy is counted atomically.
+//With DEBUG every handle remembers its thread and checks it on every use.
+template<typename T>
+class local_shared_ptr : public SW_base<T, local_shared_ptr<T>>
+{
+    template<typename U, typename... R>
+    friend Enable_if_not_array<U, local_shared_ptr<U>> make_local_shared(R&&... args);
+
+public:
+    typedef typename SW_base<T, local_shared_ptr>::element_type element_type;
+
+private:
+    typedef default_delete<typename std::conditional<std::is_array<T>::value, element_type[], T>::type> Default_deleter;
+
+#ifdef DEBUG
+    std::thread::id owner = std::this_thread::get_id();
+#endif
+
+    void check_owner() const noexcept;
+    template<typename D = Default_deleter>
+    void make_proxy(element_type* ptr = nullptr, D deleter = D());
+    local_shared_ptr(Proxy_base& p, element_type* ptr) noexcept;
+
+public:
+    constexpr local_shared_ptr() noexcept;
+    constexpr local_shared_ptr(std::nullptr_t) noexcept;
+    template<typename D = Default_deleter>
+    explicit local_shared_ptr(element_type* ptr, D deleter = D());
+    local_shared_ptr(const local_shared_ptr& lsp) noexcept;
+    local_shared_ptr(local_shared_ptr&& lsp) noexcept;
+    ~local_shared_ptr();
+
+    local_shared_ptr& operator=(const local_shared_ptr& lsp) noexcept;
+    local_shared_ptr& operator=(local_shared_ptr&& lsp) noexcept;
+
+    template<typename D = Default_deleter>
+    void reset(element_type* ptr = nullptr, D deleter = D());
+    void swap(local_shared_ptr& lsp) noexcept;
+
+    //throws bad_local_promotion unless this is the only owner
+    shared_ptr<T> promote() &&;
+
+    element_type& operator*() const noexcept;
+    element_type* operator->() const noexcept;
+    element_type& operator[](ptrdiff_t i) const noexcept;
+    operator bool() const noexcept;
+    element_type* get() const noexcept;
+
+    bool operator==(const local_shared_ptr& lsp) const noexcept;
+    bool operator!=(const local_shared_ptr& lsp) const noexcept;
+};
+
+template<typename T>
+void local_shared_ptr<T>::check_owner() const noexcept
+{
+#ifdef DEBUG
+    assert((!SW_base<T, local_shared_ptr>::proxy || owner == std::this_thread::get_id()) && "local_shared_ptr used outside of its thread");
+#endif
+}
+
+template<typename T>
+template<typename D>
+void local_shared_ptr<T>::make_proxy(element_type* ptr, D deleter)
+{
+    if(!ptr)
+    {
+        SW_base<T, local_shared_ptr>::set_proxy();
+        return;
+    }
+
+    Proxy_deleter<element_type, D>* p;
+
+    try
+    {
+        p = new Proxy_deleter<element_type, D>(ptr, std::move(deleter));
+    }
+    catch(...)
+    {
+        deleter(ptr);
+        throw;
+    }
+
+    SW_base<T, local_shared_ptr>::set_proxy(p, ptr);
+}
+
+template<typename T>
+local_shared_ptr<T>::local_shared_ptr(Proxy_base& p, element_type* ptr) noexcept
+{
+    SW_base<T, local_shared_ptr>::set_proxy(&p, ptr);
+}
+
+template<typename T>
+constexpr local_shared_ptr<T>::local_shared_ptr() noexcept
+{
+}
+
+template<typename T>
+constexpr local_shared_ptr<T>::local_shared_ptr(std::nullptr_t) noexcept
+{
+}
+
+template<typename T>
+template<typename D>
+local_shared_ptr<T>::local_shared_ptr(element_type* ptr, D deleter)
+{
+    make_proxy(ptr, std::move(deleter));
+}
+
+template<typename T>
+local_shared_ptr<T>::local_shared_ptr(const local_shared_ptr& lsp) noexcept
+{
+    lsp.check_owner();
+    SW_base<T, local_shared_ptr>::set_proxy(lsp.proxy, lsp.ptr);
+}
+
+template<typename T>
+local_shared_ptr<T>::local_shared_ptr(local_shared_ptr&& lsp) noexcept
+{
+    lsp.check_owner();
+    SW_base<T, local_shared_ptr>::adopt_proxy(lsp.proxy, lsp.ptr);
+    lsp.adopt_proxy(nullptr, nullptr);
+}
+
+template<typename T>
+local_shared_ptr<T>::~local_shared_ptr()
+{
+    check_owner();
+    SW_base<T, local_shared_ptr>::check_out();
+}
+
+template<typename T>
+local_shared_ptr<T>& local_shared_ptr<T>::operator=(const local_shared_ptr& lsp) noexcept
+{
+    local_shared_ptr<T>(lsp).swap(*this);
+    return *this;
+}
+
+template<typename T>
+local_shared_ptr<T>& local_shared_ptr<T>::operator=(local_shared_ptr&& lsp) noexcept
+{
+    local_shared_ptr<T>(std::move(lsp)).swap(*this);
+    return *this;
+}
+
+template<typename T>
+template<typename D>
+void local_shared_ptr<T>::reset(element_type* ptr, D deleter)
+{
+    local_shared_ptr<T>(ptr, std::move(deleter)).swap(*this);
+}
+
+template<typename T>
+void local_shared_ptr<T>::swap(local_shared_ptr& lsp) noexcept
+{
+    SW_base<T, local_shared_ptr>::swap(lsp);
+#ifdef DEBUG
+    std::swap(owner, lsp.owner);
+#endif
+}
+
+template<typename T>
+shared_ptr<T> local_shared_ptr<T>::promote() &&
+{
+    Proxy_base* proxy = SW_base<T, local_shared_ptr>::proxy;
+    element_type* ptr = SW_base<T, local_shared_ptr>::ptr;
+
+    check_owner();
+
+    if(!proxy)
+        return shared_ptr<T>();
+
+    if(proxy->links_count() != 1)
+        throw bad_local_promotion();
+
+    SW_base<T, local_shared_ptr>::adopt_proxy(nullptr, nullptr);
+
+    shared_ptr<T> sp(*proxy, ptr, Adopt_link());
+    if constexpr(!std::is_array<T>::value)
+        sp.wp_init_helper(ptr);
+
+    return sp;
+}
+
+template<typename T>
+typename local_shared_ptr<T>::element_type& local_shared_ptr<T>::operator*() const noexcept
+{
+    return *SW_base<T, local_shared_ptr>::ptr;
+}
+
+template<typename T>
+typename local_shared_ptr<T>::element_type* local_shared_ptr<T>::operator->() const noexcept
+{
+    return SW_base<T, local_shared_ptr>::ptr;
+}
+
+template<typename T>
+typename local_shared_ptr<T>::element_type& local_shared_ptr<T>::operator[](ptrdiff_t i) const noexcept
+{
+    return SW_base<T, local_shared_ptr>::ptr[i];
+}
+
+template<typename T>
+local_shared_ptr<T>::operator bool() const noexcept
+{
+    return SW_base<T, local_shared_ptr>::ptr != nullptr;
+}
+
+template<typename T>
+typename local_shared_ptr<T>::element_type* local_shared_ptr<T>::get() const noexcept
+{
+    return SW_base<T, local_shared_ptr>::ptr;
+}
+
+template<typename T>
+bool local_shared_ptr<T>::operator==(const local_shared_ptr& lsp) const noexcept
+{
+    return SW_base<T, local_shared_ptr>::ptr == lsp.ptr;
+}
+
+template<typename T>
+bool local_shared_ptr<T>::operator!=(const local_shared_ptr& lsp) const noexcept
+{
+    return !(*this == lsp);
+}
+
+template<typename T, typename... R>
+Enable_if_not_array<T, local_shared_ptr<T>> make_local_shared(R&&... args)
+{
+    Make_shared_proxy<T>* pb = new Make_shared_proxy<T>(std::forward<R>(args)...);
+
+    return local_shared_ptr<T>(*pb, pb->get());
+}
+
+}
+
+namespace std
+{
+
+template<typename T>
+void swap(tuz::local_shared_ptr<T>& lsp_a, tuz::local_shared_ptr<T>& lsp_b) noexcept
+{
+    lsp_a.swap(lsp_b);
+}
+
+}
+
+#endif // LOCAL_SHARED_PTR_H_INCLUDED
@@ -0,0 +1,406 @@
+#ifndef POOL_H_INCLUDED
+#define POOL_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+namespace tuz
+{
+
+struct pool_stats
+{
+    size_t hits;            //blocks taken from a free list
+    size_t misses;          //blocks taken from operator new
+    size_t remote_frees;    //blocks freed by a thread other than the owner
+    size_t retained_bytes;  //bytes kept in free lists
+};
+
+//Every thread allocates from its own pool, blocks are grouped into size
+//classes of granularity bytes. Each block starts with a header naming its
+//pool, so a block freed on another thread is collected into a batch and the
+//whole batch is pushed onto the owner's remote stack with one CAS. Only the
+//owner takes that stack, and it takes it whole, so there is no ABA.
+//Pools are never freed: the pool of an exited thread is parked as an orphan
+//and adopted by the next thread that needs a pool.
+class Block_pool
+{
+private:
+    struct Header
+    {
+        Block_pool* owner;
+        size_t size_class;
+    };
+
+    //a free block keeps the link to the next one in its payload
+    struct Free_block
+    {
+        Free_block* next;
+    };
+
+    struct Thread_state
+    {
+        Block_pool* pool;
+        bool exited;
+        //remote frees waiting to be pushed to batch_owner
+        Block_pool* batch_owner;
+        Free_block* batch_head;
+        Free_block* batch_tail;
+        size_t batch_size;
+    };
+
+    struct Thread_guard
+    {
+        ~Thread_guard();
+    };
+
+    static constexpr size_t granularity = alignof(std::max_align_t);
+    static constexpr size_t size_classes = 16;
+    static constexpr size_t max_retained = 256;
+    static constexpr size_t remote_batch = 32;
+
+    static_assert(sizeof(Header) % granularity == 0, "the header must keep the payload aligned");
+
+    Free_block* free_lists[size_classes] = {};
+    size_t free_counts[size_classes] = {};
+    std::atomic<Free_block*> remote_head{nullptr};
+
+    //written by the owner only, read by get_pool_stats()
+    std::atomic<size_t> hits{0}, misses{0}, remote_frees{0}, retained_bytes{0};
+
+    Block_pool* next_pool = nullptr;
+    Block_pool* next_orphan = nullptr;
+
+    Block_pool() = default;
+    Block_pool(const Block_pool&) = delete;
+    Block_pool& operator=(const Block_pool&) = delete;
+
+    static std::mutex& registry_mutex() noexcept;
+    static Block_pool*& all_pools() noexcept;
+    static Block_pool*& orphans() noexcept;
+    static Thread_state& state() noexcept;
+    static void guard_thread() noexcept;
+
+    static Block_pool* local();
+    static Header* header_of(void* p) noexcept;
+    static size_t block_size(size_t size_class) noexcept;
+    static void bump(std::atomic<size_t>& counter, size_t value = 1) noexcept;
+    static void drop(std::atomic<size_t>& counter, size_t value) noexcept;
+    static void flush_batch() noexcept;
+
+    void* allocate(size_t size_class);
+    void put(Free_block* block, size_t size_class) noexcept;
+    void push_remote(Free_block* head, Free_block* tail) noexcept;
+    void drain_remote() noexcept;
+    void release() noexcept;
+
+public:
+    static constexpr size_t max_block_size = granularity * size_classes;
+
+    static void* allocate_block(size_t size);
+    static void deallocate_block(void* p) noexcept;
+
+    friend pool_stats get_pool_stats() noexcept;
+};
+
+inline std::mutex& Block_pool::registry_mutex() noexcept
+{
+    static std::mutex the_mutex;
+    return the_mutex;
+}
+
+inline Block_pool*& Block_pool::all_pools() noexcept
+{
+    static Block_pool* the_list = nullptr;
+    return the_list;
+}
+
+inline Block_pool*& Block_pool::orphans() noexcept
+{
+    static Block_pool* the_list = nullptr;
+    return the_list;
+}
+
+//trivially destructible, so it stays usable after Thread_guard has run
+inline Block_pool::Thread_state& Block_pool::state() noexcept
+{
+    static thread_local Thread_state the_state;
+    return the_state;
+}
+
+//the pool and the pending batch are handed back when the thread exits
+inline void Block_pool::guard_thread() noexcept
+{
+    static thread_local Thread_guard the_guard;
+    (void)the_guard;
+}
+
+inline Block_pool* Block_pool::local()
+{
+    Thread_state& s = state();
+
+    if(s.pool || s.exited)
+        return s.pool;
+
+    guard_thread();
+
+    std::lock_guard<std::mutex> lock(registry_mutex());
+
+    if(orphans())
+    {
+        s.pool = orphans();
+        orphans() = s.pool->next_orphan;
+    }
+    else
+    {
+        s.pool = new Block_pool;
+        s.pool->next_pool = all_pools();
+        all_pools() = s.pool;
+    }
+
+    return s.pool;
+}
+
+inline Block_pool::Thread_guard::~Thread_guard()
+{
+    Thread_state& s = state();
+
+    flush_batch();
+    s.exited = true;
+
+    if(!s.pool)
+        return;
+
+    s.pool->release();
+
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    s.pool->next_orphan = orphans();
+    orphans() = s.pool;
+    s.pool = nullptr;
+}
+
+inline Block_pool::Header* Block_pool::header_of(void* p) noexcept
+{
+    return static_cast<Header*>(p) - 1;
+}
+
+inline size_t Block_pool::block_size(size_t size_class) noexcept
+{
+    return sizeof(Header) + (size_class + 1) * granularity;
+}
+
+inline void Block_pool::bump(std::atomic<size_t>& counter, size_t value) noexcept
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline void Block_pool::drop(std::atomic<size_t>& counter, size_t value) noexcept
+{
+    counter.store(counter.load(std::memory_order_relaxed) - value, std::memory_order_relaxed);
+}
+
+inline void* Block_pool::allocate(size_t size_class)
+{
+    if(!free_lists[size_class])
+        drain_remote();
+
+    if(Free_block* block = free_lists[size_class])
+    {
+        free_lists[size_class] = block->next;
+        --free_counts[size_class];
+        bump(hits);
+        drop(retained_bytes, block_size(size_class));
+
+        return block;
+    }
+
+    bump(misses);
+
+    Header* header = static_cast<Header*>(::operator new(block_size(size_class)));
+    header->owner = this;
+    header->size_class = size_class;
+
+    return header + 1;
+}
+
+inline void Block_pool::put(Free_block* block, size_t size_class) noexcept
+{
+    if(free_counts[size_class] == max_retained)
+    {
+        ::operator delete(header_of(block));
+        return;
+    }
+
+    block->next = free_lists[size_class];
+    free_lists[size_class] = block;
+    ++free_counts[size_class];
+    bump(retained_bytes, block_size(size_class));
+}
+
+inline void Block_pool::push_remote(Free_block* head, Free_block* tail) noexcept
+{
+    Free_block* current = remote_head.load(std::memory_order_relaxed);
+
+    do
+        tail->next = current;
+    while(!remote_head.compare_exchange_weak(current, head, std::memory_order_release, std::memory_order_relaxed));
+}
+
+inline void Block_pool::drain_remote() noexcept
+{
+    Free_block* block = remote_head.exchange(nullptr, std::memory_order_acquire);
+
+    while(block)
+    {
+        Free_block* next = block->next;
+        bump(remote_frees);
+        put(block, header_of(block)->size_class);
+        block = next;
+    }
+}
+
+//gives everything kept by an exiting thread back to operator delete
+inline void Block_pool::release() noexcept
+{
+    drain_remote();
+
+    for(size_t size_class = 0; size_class < size_classes; ++size_class)
+    {
+        while(Free_block* block = free_lists[size_class])
+        {
+            free_lists[size_class] = block->next;
+            ::operator delete(header_of(block));
+        }
+
+        free_counts[size_class] = 0;
+    }
+
+    retained_bytes.store(0, std::memory_order_relaxed);
+}
+
+inline void Block_pool::flush_batch() noexcept
+{
+    Thread_state& s = state();
+
+    if(!s.batch_size)
+        return;
+
+    s.batch_owner->push_remote(s.batch_head, s.batch_tail);
+    s.batch_owner = nullptr;
+    s.batch_head = s.batch_tail = nullptr;
+    s.batch_size = 0;
+}
+
+inline void* Block_pool::allocate_block(size_t size)
+{
+    Block_pool* pool = size && size <= max_block_size ? local() : nullptr;
+
+    if(!pool)
+    {
+        Header* header = static_cast<Header*>(::operator new(sizeof(Header) + size));
+        header->owner = nullptr;
+
+        return header + 1;
+    }
+
+    return pool->allocate((size - 1) / granularity);
+}
+
+inline void Block_pool::deallocate_block(void* p) noexcept
+{
+    if(!p)
+        return;
+
+    Header* header = header_of(p);
+    Block_pool* owner = header->owner;
+    Free_block* block = static_cast<Free_block*>(p);
+    Thread_state& s = state();
+
+    if(!owner)
+    {
+        ::operator delete(header);
+        return;
+    }
+
+    if(owner == s.pool)
+    {
+        owner->put(block, header->size_class);
+        return;
+    }
+
+    if(s.exited)
+    {
+        block->next = nullptr;
+        owner->push_remote(block, block);
+        return;
+    }
+
+    if(s.batch_owner != owner)
+    {
+        flush_batch();
+        guard_thread();
+        s.batch_owner = owner;
+        s.batch_tail = block;
+    }
+
+    block->next = s.batch_head;
+    s.batch_head = block;
+
+    if(++s.batch_size == remote_batch)
+        flush_batch();
+}
+
+inline pool_stats get_pool_stats() noexcept
+{
+    pool_stats stats = {};
+    std::lock_guard<std::mutex> lock(Block_pool::registry_mutex());
+
+    for(Block_pool* pool = Block_pool::all_pools(); pool; pool = pool->next_pool)
+    {
+        stats.hits += pool->hits.load(std::memory_order_relaxed);
+        stats.misses += pool->misses.load(std::memory_order_relaxed);
+        stats.remote_frees += pool->remote_frees.load(std::memory_order_relaxed);
+        stats.retained_bytes += pool->retained_bytes.load(std::memory_order_relaxed);
+    }
+
+    return stats;
+}
+
+class Plain_block
+{
+};
+
+//Proxies derive from this under TUZ_POOLED_PROXIES. Over-aligned blocks
+//and blocks larger than max_block_size bypass the pools.
+class Pooled_block
+{
+public:
+    static void* operator new(size_t size)
+    {
+        return Block_pool::allocate_block(size);
+    };
+    static void* operator new(size_t size, std::align_val_t alignment)
+    {
+        return ::operator new(size, alignment);
+    };
+    static void* operator new(size_t size, void* p) noexcept
+    {
+        return p;
+    };
+    static void operator delete(void* p) noexcept
+    {
+        Block_pool::deallocate_block(p);
+    };
+    static void operator delete(void* p, std::align_val_t alignment) noexcept
+    {
+        ::operator delete(p, alignment);
+    };
+    static void operator delete(void* p, void* place) noexcept
+    {
+    };
+};
+
+}
+
+#endif // POOL_H_INCLUDED
@@ -0,0 +1,381 @@
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#ifdef TUZ_PROFILE_LINKS
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <tuple>
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#endif
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+#endif
+
+#include "utils.h"
+
+//on average one link in TUZ_PROFILE_SAMPLE is sampled, until
+//set_link_profile_period() says otherwise
+#ifndef TUZ_PROFILE_SAMPLE
+#define TUZ_PROFILE_SAMPLE 1024
+#endif
+
+//how many return addresses a sample keeps
+#ifndef TUZ_PROFILE_DEPTH
+#define TUZ_PROFILE_DEPTH 16
+#endif
+
+namespace tuz
+{
+
+enum class Link_event
+{
+    check_in,
+    check_out,
+    count
+};
+
+//the links taken and dropped by one kind of handle at one call stack;
+//the counts are estimates, every sample stands for a period of links
+struct link_profile_site
+{
+    std::string handle;                 //e.g. shared_ptr<Node>
+    std::vector<std::string> backtrace; //innermost frame first
+    size_t check_ins;
+    size_t check_outs;
+};
+
+#ifdef TUZ_PROFILE_LINKS
+//Handles take and drop links inline in every function that copies them,
+//so the atomic operations are spread over a profile and never show up as
+//a function of their own. SW_base reports its links here; on average one
+//in a period takes a backtrace and counts it for its call stack.
+//A thread samples after a random number of links, so that loops with a
+//fixed pattern of copies don't always hit the same one. Samples go to
+//the shard of the thread, and the rare lock they take is uncontended.
+//The profiler is never destroyed: handles may die during static destruction.
+class Link_profiler
+{
+private:
+    static constexpr size_t shards = 16;
+    static constexpr size_t site_buckets = 256;
+
+    struct Site
+    {
+        Site* next;
+        size_t hash;
+        const char* handle;     //from type_signature<P>()
+        int depth;
+        void* frames[TUZ_PROFILE_DEPTH];
+        size_t counts[size_t(Link_event::count)];
+    };
+
+    struct alignas(cache_line_size) Shard
+    {
+        std::mutex mutex;
+        Site* sites[site_buckets] = {};
+    };
+
+    Shard shard[shards];
+    std::atomic<size_t> period{TUZ_PROFILE_SAMPLE};
+
+    Link_profiler() = default;
+    Link_profiler(const Link_profiler&) = delete;
+    Link_profiler& operator=(const Link_profiler&) = delete;
+
+    static size_t shard_index() noexcept;
+    static size_t& countdown() noexcept;
+    size_t next_countdown() noexcept;
+
+public:
+    static Link_profiler& instance();
+
+    //true once in a while, for the caller to record()
+    static bool take_sample() noexcept;
+    void record(Link_event event, const char* handle) noexcept;
+
+    void set_period(size_t new_period) noexcept;
+    void reset() noexcept;
+    std::vector<link_profile_site> snapshot();
+};
+
+inline Link_profiler& Link_profiler::instance()
+{
+    static Link_profiler* the_profiler = new Link_profiler;
+    return *the_profiler;
+}
+
+//threads take the shards in turn
+inline size_t Link_profiler::shard_index() noexcept
+{
+    static std::atomic<size_t> next_index{0};
+    static thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % shards;
+
+    return index;
+}
+
+//links left until the next sample; the first link of a thread is sampled
+inline size_t& Link_profiler::countdown() noexcept
+{
+    static thread_local size_t the_countdown = 1;
+    return the_countdown;
+}
+
+inline bool Link_profiler::take_sample() noexcept
+{
+    return !--countdown();
+}
+
+//uniform in [1, 2 * period), so the mean is the period; without a period
+//the thread looks again after a while
+inline size_t Link_profiler::next_countdown() noexcept
+{
+    static thread_local uint64_t state = 0x9e3779b97f4a7c15 ^ shard_index();
+    size_t p = period.load(std::memory_order_relaxed);
+
+    if(!p)
+        return size_t(1) << 20;
+
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    return 1 + state % (2 * p - 1);
+}
+
+//out of line, so the first frame of the backtrace is always this one
+__attribute__((noinline))
+inline void Link_profiler::record(Link_event event, const char* handle) noexcept
+{
+    size_t weight = period.load(std::memory_order_relaxed);
+
+    countdown() = next_countdown();
+
+    if(!weight)
+        return;
+
+    void* frames[TUZ_PROFILE_DEPTH + 1];
+    int depth = 0;
+
+#if __has_include(<execinfo.h>)
+    depth = backtrace(frames, TUZ_PROFILE_DEPTH + 1) - 1;
+#endif
+
+    if(depth < 0)
+        depth = 0;
+
+    size_t hash = reinterpret_cast<uintptr_t>(handle) ^ size_t(depth);
+
+    for(int i = 0; i < depth; ++i)
+        hash = (hash ^ reinterpret_cast<uintptr_t>(frames[i + 1])) * 0x100000001b3;
+
+    Shard& s = shard[shard_index()];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    Site*& bucket = s.sites[hash % site_buckets];
+    Site* site = bucket;
+
+    while(site && !(site->hash == hash && site->handle == handle && site->depth == depth &&
+        std::equal(frames + 1, frames + 1 + depth, site->frames)))
+        site = site->next;
+
+    if(!site)
+    {
+        site = new(std::nothrow) Site;
+
+        if(!site)
+            return;
+
+        site->next = bucket;
+        site->hash = hash;
+        site->handle = handle;
+        site->depth = depth;
+        std::copy(frames + 1, frames + 1 + depth, site->frames);
+        std::fill(site->counts, site->counts + size_t(Link_event::count), 0);
+        bucket = site;
+    }
+
+    site->counts[size_t(event)] += weight;
+}
+
+inline void Link_profiler::set_period(size_t new_period) noexcept
+{
+    period.store(new_period, std::memory_order_relaxed);
+}
+
+//the sites stay, their counts start again
+inline void Link_profiler::reset() noexcept
+{
+    for(Shard& s : shard)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+
+        for(Site* bucket : s.sites)
+            for(Site* site = bucket; site; site = site->next)
+                std::fill(site->counts, site->counts + size_t(Link_event::count), 0);
+    }
+}
+
+//the same stack may be sampled in several shards, so stacks are told
+//apart by their frames; symbols are looked up after the locks are released
+inline std::vector<link_profile_site> Link_profiler::snapshot()
+{
+    typedef std::pair<const char*, std::vector<void*>> Key;
+
+    std::map<Key, size_t> index;
+    std::vector<Key> keys;
+    std::vector<link_profile_site> sites;
+
+    for(Shard& s : shard)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+
+        for(Site* bucket : s.sites)
+            for(Site* site = bucket; site; site = site->next)
+            {
+                size_t check_ins = site->counts[size_t(Link_event::check_in)];
+                size_t check_outs = site->counts[size_t(Link_event::check_out)];
+
+                if(!check_ins && !check_outs)
+                    continue;
+
+                Key key(site->handle, std::vector<void*>(site->frames, site->frames + site->depth));
+                auto found = index.emplace(key, sites.size());
+
+                if(found.second)
+                {
+                    keys.push_back(key);
+                    sites.push_back(link_profile_site{std::string(), std::vector<std::string>(), 0, 0});
+                }
+
+                sites[found.first->second].check_ins += check_ins;
+                sites[found.first->second].check_outs += check_outs;
+            }
+    }
+
+    for(size_t i = 0; i < sites.size(); ++i)
+    {
+        sites[i].handle = type_name(keys[i].first);
+
+#if __has_include(<execinfo.h>)
+        if(char** symbols = keys[i].second.empty() ? nullptr : backtrace_symbols(keys[i].second.data(), int(keys[i].second.size())))
+        {
+            sites[i].backtrace.assign(symbols, symbols + keys[i].second.size());
+            std::free(symbols);
+        }
+#endif
+    }
+
+    std::sort(sites.begin(), sites.end(), [](const link_profile_site& a, const link_profile_site& b)
+    {
+        return std::tie(a.check_ins, a.check_outs) > std::tie(b.check_ins, b.check_outs);
+    });
+
+    return sites;
+}
+
+//"binary(mangled+0x1f) [0x...]" from backtrace_symbols() to the demangled
+//function, or the address when the symbol isn't known
+inline std::string profile_frame_name(const std::string& symbol)
+{
+    size_t open = symbol.find('('), plus = symbol.find('+', open);
+
+    if(open == std::string::npos || plus == std::string::npos || plus == open + 1)
+    {
+        size_t bracket = symbol.rfind('[');
+        return bracket == std::string::npos ? symbol : symbol.substr(bracket + 1, symbol.size() - bracket - 2);
+    }
+
+    std::string mangled = symbol.substr(open + 1, plus - open - 1);
+
+#if __has_include(<cxxabi.h>)
+    int status = 0;
+
+    if(char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status))
+    {
+        mangled = demangled;
+        std::free(demangled);
+    }
+#endif
+
+    return mangled;
+}
+#endif
+
+//called by SW_base for every link it takes or drops
+template<typename P>
+inline void profile_link(Link_event event) noexcept
+{
+#ifdef TUZ_PROFILE_LINKS
+    if(Link_profiler::take_sample())
+        Link_profiler::instance().record(event, type_signature<P>());
+#else
+    (void)event;
+#endif
+}
+
+//on average one link in period is sampled, 0 stops sampling; a thread
+//takes the new period at its next sample. Does nothing without TUZ_PROFILE_LINKS
+inline void set_link_profile_period(size_t period) noexcept
+{
+#ifdef TUZ_PROFILE_LINKS
+    Link_profiler::instance().set_period(period);
+#else
+    (void)period;
+#endif
+}
+
+inline void reset_link_profile() noexcept
+{
+#ifdef TUZ_PROFILE_LINKS
+    Link_profiler::instance().reset();
+#endif
+}
+
+//the sampled call stacks, the most links first; empty without TUZ_PROFILE_LINKS
+inline std::vector<link_profile_site> link_profile()
+{
+#ifdef TUZ_PROFILE_LINKS
+    return Link_profiler::instance().snapshot();
+#else
+    return std::vector<link_profile_site>();
+#endif
+}
+
+//The profile as folded stacks, one "outermost;...;innermost;handle event count"
+//line per stack and event, as flamegraph.pl, inferno and speedscope read them
+inline void write_link_profile(std::FILE* out)
+{
+#ifdef TUZ_PROFILE_LINKS
+    for(const link_profile_site& site : link_profile())
+    {
+        std::string stack;
+
+        for(auto frame = site.backtrace.rbegin(); frame != site.backtrace.rend(); ++frame)
+            stack += profile_frame_name(*frame) + ';';
+
+        stack += site.handle;
+
+        if(site.check_ins)
+            std::fprintf(out, "%s check_in %zu\n", stack.c_str(), site.check_ins);
+
+        if(site.check_outs)
+            std::fprintf(out, "%s check_out %zu\n", stack.c_str(), site.check_outs);
+    }
+#else
+    (void)out;
+#endif
+}
+
+}
+
+#endif // PROFILE_H_INCLUDED
@@ -1,8 +1,26 @@
 #ifndef PROXY_H_INCLUDED
 #define PROXY_H_INCLUDED
 
+#include <atomic>
+#include <memory>
+#include <new>
+#ifdef TUZ_TRACK_PROXIES
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#endif
+
 #include "utils.h"
+#include "counter.h"
+#include "pool.h"
 #include "unique_ptr.h"
+#include "teardown.h"
+#include "instrument.h"
+#include "track.h"
+#include "timing.h"
+#ifdef TUZ_BIASED_REFCOUNT
+#include "biased.h"
+#endif
 
 namespace tuz
 {
@@ -14,152 +32,831 @@ template<typename T>
 class shared_ptr;
 
 template<typename T>
-class Proxy_base
+class local_shared_ptr;
+
+class Proxy_base;
+
+class cycle_tracer;
+
+enum class Proxy_op
+{
+    dispose,    //destroy the owned object
+    destroy     //free the proxy itself
+};
+
+//what a proxy manager does to T
+template<typename T>
+inline void instrument(Proxy_op op) noexcept
+{
+    instrument<T>(op == Proxy_op::dispose ? Instrument_event::object_destroyed : Instrument_event::proxy_destroyed);
+}
+
+#ifdef TUZ_POOLED_PROXIES
+typedef Pooled_block Proxy_storage;
+#else
+typedef Plain_block Proxy_storage;
+#endif
+
+#ifdef TUZ_BIASED_REFCOUNT
+typedef biased_counter shared_counter;
+#else
+typedef default_counter shared_counter;
+#endif
+
+typedef void (*Proxy_manager)(Proxy_base* proxy, Proxy_op op) noexcept;
+
+//Proxy_base doesn't know the type of the object it owns: shared_ptr<Base>,
+//shared_ptr<Derived> and aliasing pointers to members share one proxy, and
+//each handle keeps its own object pointer.
+//Instead of a vtable every concrete proxy passes its own manager function,
+//so the common header is one pointer and two 32-bit counters.
+//Proxy_storage decides where proxies created with new come from.
+//Under TUZ_BIASED_REFCOUNT the shared links are biased towards the thread
+//that created the proxy, see biased.h.
+class Proxy_base : public Proxy_storage
 {
 private:
-    size_t shared_links, weak_links;
-    T* ptr;
+    Proxy_manager manager;
+    //shared owners together hold one weak link, so the proxy outlives
+    //the object for as long as any owner may still touch it
+    shared_counter shared_links;
+    default_counter weak_links;
+
+#ifdef TUZ_BIASED_REFCOUNT
+    friend class Biased_owner;
+
+    Proxy_base* queue_next = nullptr;
+
+    bool enqueue_biased() noexcept;
+    bool merge_biased() noexcept;
+#endif
+
+#ifdef TUZ_TRACK_PROXIES
+    friend class Proxy_registry;
+
+    Track_node tracked;
+#endif
 
     Proxy_base(const Proxy_base&) = delete;
     Proxy_base& operator=(const Proxy_base&) = delete;
 
+    bool teardown() noexcept;
+    void possible_root() noexcept;
+
+protected:
+#ifdef TUZ_TRACK_PROXIES
+    ~Proxy_base()
+    {
+        Proxy_registry::instance().remove(tracked);
+    };
+#else
+    ~Proxy_base() = default;
+#endif
+
+    //every concrete proxy calls it once its object exists; bytes is the
+    //size of the block the proxy is in
+    template<typename T>
+    void created(Instrument_event allocation, size_t bytes) noexcept;
+
 public:
-explicit Proxy_base(T* ptr, size_t shared_links = 0, size_t weak_links = 0) noexcept :
-    shared_links(shared_links), weak_links(weak_links), ptr(ptr) {};
+explicit Proxy_base(Proxy_manager manager, size_t shared_links = 0, size_t weak_links = 1) noexcept :
+    manager(manager), shared_links(shared_links), weak_links(weak_links) {};
 
     template<typename D>
-    void check_in(Identity<shared_ptr<D>> sp) noexcept;
+    void check_in(Identity<shared_ptr<D>> sp, size_t links = 1) noexcept;
     template<typename D>
     void check_in(Identity<weak_ptr<D>> wp) noexcept;
     template<typename D>
-    void check_out(Identity<shared_ptr<D>> sp) noexcept;
+    bool try_check_in(Identity<shared_ptr<D>> sp) noexcept;
+    //for a proxy that no other thread can see yet
+    template<typename D>
+    void check_in_unshared(Identity<weak_ptr<D>> wp) noexcept;
+    template<typename D>
+    bool check_out(Identity<shared_ptr<D>> sp, size_t links = 1) noexcept;
+    template<typename D>
+    bool check_out(Identity<weak_ptr<D>> wp) noexcept;
+    template<typename D>
+    void check_in(Identity<local_shared_ptr<D>> lsp) noexcept;
     template<typename D>
-    void check_out(Identity<weak_ptr<D>> wp) noexcept;
+    bool check_out(Identity<local_shared_ptr<D>> lsp) noexcept;
 
     size_t links_count() const noexcept;
+    bool managed_by(Proxy_manager m) const noexcept;
 
 #ifdef DEBUG
     size_t DEBUG_weak_links_count() const noexcept
     {
-        return weak_links;
+        return weak_links.load() - (shared_links.load() ? 1 : 0);
     };
 #endif
 
-    bool need_deletion() const noexcept;
     bool expired() const noexcept;
 
-    T* get() const noexcept;
+    void delete_() noexcept;
+    void destroy() noexcept;
+};
+
+//The header of the proxies made by make_shared_collectable. Proxy_base
+//knows them by their manager and reports every link they are about to
+//lose, which makes the object a possible root of a garbage cycle. The
+//possible roots wait on a lock-free stack, each holding a weak link, until
+//the collector in cycles.h takes them.
+class Collectable_proxy : public Proxy_base
+{
+    friend class Cycle_collector;
+
+public:
+    struct Ops
+    {
+        Proxy_manager manage;
+        void (*trace)(Collectable_proxy* proxy, cycle_tracer& tracer);
+        size_t bytes;
+    };
+
+    enum class Color : unsigned char
+    {
+        black,  //in use
+        gray,   //visited by trial deletion
+        white,  //garbage unless something outside the subgraph links to it
+        orange  //taken as garbage, checked again before it is freed
+    };
+
+private:
+    const Ops* ops;
+    std::atomic<bool> buffered{false};
+    //set by the collector, the object is already destroyed
+    bool disposed = false;
+    Color color = Color::black;
+    //links left after trial deletion of the links inside the subgraph
+    ptrdiff_t trial = 0;
+    Collectable_proxy* next_root = nullptr;
+
+    static std::atomic<Collectable_proxy*>& possible_roots() noexcept;
+    static std::atomic<size_t>& possible_roots_count() noexcept;
+
+protected:
+    explicit Collectable_proxy(const Ops* ops) noexcept : Proxy_base(&manage), ops(ops) {};
 
-    virtual void delete_(T* ptr) noexcept = 0;
-    virtual ~Proxy_base() = default;
+public:
+    static void manage(Proxy_base* proxy, Proxy_op op) noexcept;
+
+    void buffer() noexcept;
 };
 
-template<typename T>
-bool Proxy_base<T>::need_deletion() const noexcept
+inline std::atomic<Collectable_proxy*>& Collectable_proxy::possible_roots() noexcept
 {
-    return !shared_links && !weak_links;
+    static std::atomic<Collectable_proxy*> the_stack{nullptr};
+    return the_stack;
 }
 
-template<typename T>
-bool Proxy_base<T>::expired() const noexcept
+inline std::atomic<size_t>& Collectable_proxy::possible_roots_count() noexcept
 {
-    return !shared_links;
+    static std::atomic<size_t> the_count{0};
+    return the_count;
+}
+
+inline void Collectable_proxy::manage(Proxy_base* proxy, Proxy_op op) noexcept
+{
+    Collectable_proxy* self = static_cast<Collectable_proxy*>(proxy);
+
+    if(op == Proxy_op::dispose && self->disposed)
+        return;
+
+    self->ops->manage(proxy, op);
+}
+
+//the caller still holds a link, so the proxy can't go away meanwhile
+inline void Collectable_proxy::buffer() noexcept
+{
+    if(buffered.load(std::memory_order_relaxed) || buffered.exchange(true, std::memory_order_relaxed))
+        return;
+
+    check_in(Identity<weak_ptr<Collectable_proxy>>());
+    possible_roots_count().fetch_add(1, std::memory_order_relaxed);
+
+    next_root = possible_roots().load(std::memory_order_relaxed);
+
+    while(!possible_roots().compare_exchange_weak(next_root, this, std::memory_order_release, std::memory_order_relaxed))
+        ;
 }
 
 template<typename T>
+void Proxy_base::created(Instrument_event allocation, size_t bytes) noexcept
+{
+    instrument<T>(allocation);
+
+#ifdef TUZ_TRACK_PROXIES
+    Proxy_registry::instance().add(tracked, this, type_signature<typename std::remove_cv<T>::type>(), bytes);
+#endif
+}
+
+inline bool Proxy_base::managed_by(Proxy_manager m) const noexcept
+{
+    return manager == m;
+}
+
+inline void Proxy_base::possible_root() noexcept
+{
+    if(managed_by(&Collectable_proxy::manage))
+        static_cast<Collectable_proxy*>(this)->buffer();
+}
+
+inline void Proxy_base::delete_() noexcept
+{
+    manager(this, Proxy_op::dispose);
+}
+
+inline void Proxy_base::destroy() noexcept
+{
+    manager(this, Proxy_op::destroy);
+}
+
+//destroys the object, unless the thread is already too deep in other
+//destructors; then the object waits on the worklist, which also releases
+//the weak link of the owners, and the result is false
+inline bool Proxy_base::teardown() noexcept
+{
+    size_t& depth = Teardown_list::depth();
+
+    if(depth >= TUZ_TEARDOWN_DEPTH_LIMIT && Teardown_list::push(this))
+        return false;
+
+    ++depth;
+    delete_();
+
+    if(depth == 1)
+        while(Proxy_base* pending = Teardown_list::pop())
+        {
+            pending->delete_();
+
+            if(!pending->weak_links.decrement())
+                pending->destroy();
+        }
+
+    --depth;
+
+    return true;
+}
+
+inline bool Proxy_base::expired() const noexcept
+{
+    return !shared_links.load();
+}
+
+#ifdef TUZ_TRACK_PROXIES
+//the same site may be stored in several shards, so sites are told apart
+//by their frames; symbols are looked up after the locks are released
+inline std::vector<tracked_site> Proxy_registry::snapshot()
+{
+    typedef std::pair<const char*, std::vector<void*>> Key;
+
+    std::map<Key, size_t> index;
+    std::vector<Key> keys;
+    std::vector<tracked_site> sites;
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    for(Shard& s : shard)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+
+        for(const Track_node* node = s.head; node; node = node->next)
+        {
+            const Proxy_base* proxy = node->proxy;
+            Key key(node->signature, std::vector<void*>());
+
+            if(node->site)
+                key.second.assign(node->site->frames, node->site->frames + node->site->depth);
+
+            auto found = index.emplace(key, sites.size());
+
+            if(found.second)
+            {
+                keys.push_back(key);
+                sites.push_back(tracked_site{std::string(), std::vector<std::string>(), 0, std::vector<tracked_block>()});
+            }
+
+            tracked_site& site = sites[found.first->second];
+            size_t shared_links = proxy->shared_links.load();
+
+            site.bytes += node->bytes;
+            site.blocks.push_back(tracked_block{shared_links, proxy->weak_links.load() - (shared_links ? 1 : 0), node->bytes, (now - node->created) / 1e9});
+        }
+    }
+
+    for(size_t i = 0; i < sites.size(); ++i)
+    {
+        sites[i].type = type_name(keys[i].first);
+
+        std::sort(sites[i].blocks.begin(), sites[i].blocks.end(), [](const tracked_block& a, const tracked_block& b)
+        {
+            return a.age > b.age;
+        });
+
+#if __has_include(<execinfo.h>)
+        if(char** symbols = keys[i].second.empty() ? nullptr : backtrace_symbols(keys[i].second.data(), int(keys[i].second.size())))
+        {
+            sites[i].backtrace.assign(symbols, symbols + keys[i].second.size());
+            std::free(symbols);
+        }
+#endif
+    }
+
+    std::sort(sites.begin(), sites.end(), [](const tracked_site& a, const tracked_site& b)
+    {
+        return a.bytes > b.bytes;
+    });
+
+    return sites;
+}
+#endif
+
 template<typename D>
-void Proxy_base<T>::check_in(Identity<shared_ptr<D>> sp) noexcept
+void Proxy_base::check_in(Identity<shared_ptr<D>> sp, size_t links) noexcept
 {
-    ++shared_links;
+    instrument<D>(Instrument_event::shared_check_in, links);
+    shared_links.increment(links);
 }
 
-template<typename T>
 template<typename D>
-void Proxy_base<T>::check_in(Identity<weak_ptr<D>> wp) noexcept
+void Proxy_base::check_in(Identity<weak_ptr<D>> wp) noexcept
 {
-    ++weak_links;
+    instrument<D>(Instrument_event::weak_check_in);
+    weak_links.increment();
 }
 
-template<typename T>
 template<typename D>
-void Proxy_base<T>::check_out(Identity<shared_ptr<D>> sp) noexcept
+bool Proxy_base::try_check_in(Identity<shared_ptr<D>> sp) noexcept
 {
-    if(shared_links == 1)
-        delete_(ptr);
+    if(!shared_links.increment_if_not_zero())
+    {
+        instrument<D>(Instrument_event::failed_lock);
+        return false;
+    }
 
-    --shared_links;
+    instrument<D>(Instrument_event::shared_check_in);
+    return true;
 }
 
-template<typename T>
 template<typename D>
-void Proxy_base<T>::check_out(Identity<weak_ptr<D>> wp) noexcept
+void Proxy_base::check_in_unshared(Identity<weak_ptr<D>> wp) noexcept
 {
-    --weak_links;
+    instrument<D>(Instrument_event::weak_check_in);
+    weak_links.increment_local();
 }
 
-template<typename T>
-size_t Proxy_base<T>::links_count() const noexcept
+//returns true when the proxy itself has to be deleted
+template<typename D>
+bool Proxy_base::check_out(Identity<shared_ptr<D>> sp, size_t links) noexcept
 {
-    return shared_links;
+    instrument<D>(Instrument_event::shared_check_out, links);
+    possible_root();
+
+#ifdef TUZ_BIASED_REFCOUNT
+    bool enqueue = false;
+
+    if(shared_links.decrement(links, enqueue))
+        return enqueue && enqueue_biased();
+#else
+    if(shared_links.decrement(links))
+        return false;
+#endif
+
+    if(!teardown())
+        return false;
+
+    return !weak_links.decrement();
 }
 
-template<typename T>
-T* Proxy_base<T>::get() const noexcept
+template<typename D>
+bool Proxy_base::check_out(Identity<weak_ptr<D>> wp) noexcept
 {
-    return ptr;
+    instrument<D>(Instrument_event::weak_check_out);
+    return !weak_links.decrement();
 }
 
-template<typename T>
-class Proxy_dummy : public Proxy_base<T>
+//local owners never share the proxy with another thread, and there are no
+//weak links besides the one they hold together.
+//Biased counters are already plain on the owner thread.
+template<typename D>
+void Proxy_base::check_in(Identity<local_shared_ptr<D>> lsp) noexcept
+{
+#ifdef TUZ_BIASED_REFCOUNT
+    check_in(Identity<shared_ptr<D>>());
+#else
+    instrument<D>(Instrument_event::shared_check_in);
+    shared_links.increment_local();
+#endif
+}
+
+template<typename D>
+bool Proxy_base::check_out(Identity<local_shared_ptr<D>> lsp) noexcept
+{
+#ifdef TUZ_BIASED_REFCOUNT
+    return check_out(Identity<shared_ptr<D>>());
+#else
+    instrument<D>(Instrument_event::shared_check_out);
+    possible_root();
+
+    if(shared_links.decrement_local())
+        return false;
+
+    if(!teardown())
+        return false;
+
+    return !weak_links.decrement_local();
+#endif
+}
+
+inline size_t Proxy_base::links_count() const noexcept
+{
+    return shared_links.load();
+}
+
+#ifdef TUZ_BIASED_REFCOUNT
+//returns true when the proxy itself has to be deleted
+inline bool Proxy_base::enqueue_biased() noexcept
+{
+    Biased_owner* owner = shared_links.get_owner();
+
+    if(owner && owner->push(this))
+        return false;
+
+    return merge_biased();
+}
+
+inline bool Proxy_base::merge_biased() noexcept
+{
+    if(shared_links.merge())
+        return false;
+
+    if(!teardown())
+        return false;
+
+    return !weak_links.decrement();
+}
+
+inline bool Biased_owner::push(Proxy_base* proxy) noexcept
+{
+    Proxy_base* head = queue.load(std::memory_order_acquire);
+
+    do
+    {
+        if(head == dead())
+            return false;
+
+        proxy->queue_next = head;
+    }
+    while(!queue.compare_exchange_weak(head, proxy, std::memory_order_release, std::memory_order_acquire));
+
+    return true;
+}
+
+inline void Biased_owner::merge_all(Proxy_base* list) noexcept
+{
+    while(list)
+    {
+        Proxy_base* next = list->queue_next;
+
+        if(list->merge_biased())
+            list->destroy();
+
+        list = next;
+    }
+}
+
+//merges the proxies other threads have queued to this one
+inline void drain_biased_queue() noexcept
+{
+    if(Biased_owner* owner = Biased_owner::current())
+        owner->drain();
+}
+#endif
+
+//stateless deleters take no space thanks to Ebo_holder
+template<typename T, typename D>
+class Proxy_deleter : public Proxy_base, private Ebo_holder<D>
 {
 private:
-Proxy_dummy() noexcept :
-    Proxy_base<T>(nullptr, 1) {};
+    T* ptr;
+
+    static void manage(Proxy_base* proxy, Proxy_op op) noexcept;
 
 public:
-    static Proxy_dummy* instance_ptr() noexcept
+Proxy_deleter(T* ptr, D&& deleter) :
+    Proxy_base(&manage), Ebo_holder<D>(std::move(deleter)), ptr(ptr)
     {
-        static Proxy_dummy the_single_instance;
-        return &the_single_instance;
+        created<T>(Instrument_event::separate_allocation, sizeof(*this));
     };
-    virtual void delete_(T* ptr) noexcept override {};
 };
 
 template<typename T, typename D>
-class Proxy_deleter : public Proxy_base<T>
+void Proxy_deleter<T, D>::manage(Proxy_base* proxy, Proxy_op op) noexcept
+{
+    Proxy_deleter* self = static_cast<Proxy_deleter*>(proxy);
+
+    instrument<T>(op);
+
+    if(op == Proxy_op::dispose)
+    {
+        Destructor_timer<T> timer(Known_size<T>::value);
+        self->held()(self->ptr);
+    }
+    else
+        delete self;
+}
+
+//the proxy is allocated from A and the allocator is kept in it,
+//so the proxy goes back to the resource it came from
+template<typename T, typename D, typename A>
+class Proxy_deleter_alloc : public Proxy_base, private Ebo_holder<D>, private Ebo_holder<A>
 {
 private:
-    D deleter;
+    typedef typename std::allocator_traits<A>::template rebind_alloc<Proxy_deleter_alloc> Proxy_allocator;
+    typedef std::allocator_traits<Proxy_allocator> Proxy_traits;
+
+    T* ptr;
+
+    static void manage(Proxy_base* proxy, Proxy_op op) noexcept;
+
+Proxy_deleter_alloc(T* ptr, D&& deleter, const A& alloc) :
+    Proxy_base(&manage), Ebo_holder<D>(std::move(deleter)), Ebo_holder<A>(alloc), ptr(ptr)
+    {
+        created<T>(Instrument_event::separate_allocation, sizeof(*this));
+    };
 
 public:
-    Proxy_deleter(T* ptr, const D& deleter) : Proxy_base<T>(ptr), deleter(deleter) {};
+    static Proxy_deleter_alloc* create(T* ptr, D&& deleter, const A& alloc);
+};
+
+template<typename T, typename D, typename A>
+Proxy_deleter_alloc<T, D, A>* Proxy_deleter_alloc<T, D, A>::create(T* ptr, D&& deleter, const A& alloc)
+{
+    Proxy_allocator proxy_alloc(alloc);
+    Proxy_deleter_alloc* p = Proxy_traits::allocate(proxy_alloc, 1);
+
+    try
+    {
+        return new(static_cast<void*>(p)) Proxy_deleter_alloc(ptr, std::move(deleter), alloc);
+    }
+    catch(...)
+    {
+        Proxy_traits::deallocate(proxy_alloc, p, 1);
+        throw;
+    }
+}
+
+template<typename T, typename D, typename A>
+void Proxy_deleter_alloc<T, D, A>::manage(Proxy_base* proxy, Proxy_op op) noexcept
+{
+    Proxy_deleter_alloc* self = static_cast<Proxy_deleter_alloc*>(proxy);
+
+    instrument<T>(op);
+
+    if(op == Proxy_op::dispose)
+    {
+        Destructor_timer<T> timer(Known_size<T>::value);
+        self->Ebo_holder<D>::held()(self->ptr);
+        return;
+    }
+
+    Proxy_allocator proxy_alloc(self->Ebo_holder<A>::held());
+
+    self->~Proxy_deleter_alloc();
+    Proxy_traits::deallocate(proxy_alloc, self, 1);
+}
+
+//alignas(T) makes new pick the aligned operator new for over-aligned T.
+//With A = cache_line_size the object starts on its own cache line and the
+//counters stay on the previous one.
+template<typename T, size_t A = alignof(T)>
+class Make_shared_proxy : public Proxy_base
+{
+private:
+    alignas(T) alignas(A) unsigned char data[sizeof(T)];
+
+    static void manage(Proxy_base* proxy, Proxy_op op) noexcept;
+
+public:
+    template<typename... R>
+    Make_shared_proxy(R&&... args) : Proxy_base(&manage)
+    {
+        new(get()) T(std::forward<R>(args)...);
+        created<T>(Instrument_event::make_shared_allocation, sizeof(*this));
+    };
+    explicit Make_shared_proxy(For_overwrite) : Proxy_base(&manage)
+    {
+        new(get()) T;
+        created<T>(Instrument_event::make_shared_allocation, sizeof(*this));
+    };
 
-    virtual void delete_(T* ptr) noexcept override
+    T* get() noexcept
     {
-        deleter(ptr);
+        return reinterpret_cast<T*>(data);
     };
 };
 
+template<typename T, size_t A>
+void Make_shared_proxy<T, A>::manage(Proxy_base* proxy, Proxy_op op) noexcept
+{
+    Make_shared_proxy* self = static_cast<Make_shared_proxy*>(proxy);
+
+    instrument<T>(op);
+
+    if(op == Proxy_op::dispose)
+    {
+        Destructor_timer<T> timer(sizeof(T));
+        self->get()->~T();
+    }
+    else
+        delete self;
+}
 
+//the count elements follow the proxy in the same allocation
 template<typename T>
-class Make_shared_proxy : public Proxy_base<T>
+class Make_shared_array_proxy : public Proxy_base
 {
 private:
-    char data[sizeof(T)];
+    size_t count;
+
+    static constexpr bool over_aligned = alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+explicit Make_shared_array_proxy(size_t count) noexcept :
+    Proxy_base(&manage), count(count) {};
+
+    static size_t data_offset() noexcept;
+    static void* allocate(size_t count);
+    static void deallocate(void* memory) noexcept;
+    static void manage(Proxy_base* proxy, Proxy_op op) noexcept;
+
+public:
+    //pattern is repeated over the array, without it the elements are
+    //value-initialized, or default-initialized when overwrite is set
+    static Make_shared_array_proxy* create(size_t count, const T* pattern, size_t pattern_size, bool overwrite);
 
-    virtual void delete_(T* ptr) noexcept override
+    T* get() noexcept
     {
-        Proxy_base<T>::get()->~T();
+        return reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(this) + data_offset());
+    };
+};
+
+template<typename T>
+size_t Make_shared_array_proxy<T>::data_offset() noexcept
+{
+    return (sizeof(Make_shared_array_proxy) + alignof(T) - 1) / alignof(T) * alignof(T);
+}
+
+template<typename T>
+void* Make_shared_array_proxy<T>::allocate(size_t count)
+{
+    if(count > (size_t(-1) - data_offset()) / sizeof(T))
+        throw std::bad_array_new_length();
+
+    size_t size = data_offset() + count * sizeof(T);
+
+    if(over_aligned)
+        return ::operator new(size, std::align_val_t(alignof(T)));
+    else
+        return ::operator new(size);
+}
+
+template<typename T>
+void Make_shared_array_proxy<T>::deallocate(void* memory) noexcept
+{
+    if(over_aligned)
+        ::operator delete(memory, std::align_val_t(alignof(T)));
+    else
+        ::operator delete(memory);
+}
+
+template<typename T>
+Make_shared_array_proxy<T>* Make_shared_array_proxy<T>::create(size_t count, const T* pattern, size_t pattern_size, bool overwrite)
+{
+    void* memory = allocate(count);
+    Make_shared_array_proxy* self = new(memory) Make_shared_array_proxy(count);
+    T* data = self->get();
+    size_t i = 0;
+
+    try
+    {
+        if(pattern)
+            for(; i < count; ++i)
+                new(data + i) T(pattern[i % pattern_size]);
+        else if(overwrite)
+            for(; i < count; ++i)
+                new(data + i) T;
+        else
+            for(; i < count; ++i)
+                new(data + i) T();
+    }
+    catch(...)
+    {
+        while(i)
+            data[--i].~T();
+
+        self->~Make_shared_array_proxy();
+        deallocate(memory);
+        throw;
+    }
+
+    self->template created<T>(Instrument_event::make_shared_allocation, data_offset() + count * sizeof(T));
+
+    return self;
+}
+
+template<typename T>
+void Make_shared_array_proxy<T>::manage(Proxy_base* proxy, Proxy_op op) noexcept
+{
+    Make_shared_array_proxy* self = static_cast<Make_shared_array_proxy*>(proxy);
+
+    instrument<T>(op);
+
+    if(op == Proxy_op::dispose)
+    {
+        Destructor_timer<T[]> timer(self->count * sizeof(T));
+        T* data = self->get();
+
+        for(size_t i = self->count; i; --i)
+            data[i - 1].~T();
+
+        return;
+    }
+
+    self->~Make_shared_array_proxy();
+    deallocate(self);
+}
+
+//Make_shared_proxy whose memory comes from A; the object is constructed
+//and destroyed through A rebound to T, as std::allocate_shared does
+template<typename T, typename A>
+class Allocate_shared_proxy : public Proxy_base, private Ebo_holder<A>
+{
+private:
+    typedef typename std::allocator_traits<A>::template rebind_alloc<Allocate_shared_proxy> Proxy_allocator;
+    typedef std::allocator_traits<Proxy_allocator> Proxy_traits;
+    typedef typename std::allocator_traits<A>::template rebind_alloc<T> Object_allocator;
+    typedef std::allocator_traits<Object_allocator> Object_traits;
+
+    alignas(T) unsigned char data[sizeof(T)];
+
+    static void manage(Proxy_base* proxy, Proxy_op op) noexcept;
+
+    template<typename... R>
+    Allocate_shared_proxy(const A& alloc, R&&... args) : Proxy_base(&manage), Ebo_holder<A>(alloc)
+    {
+        Object_allocator object_alloc(alloc);
+        Object_traits::construct(object_alloc, get(), std::forward<R>(args)...);
+        created<T>(Instrument_event::make_shared_allocation, sizeof(*this));
     };
 
 public:
     template<typename... R>
-    Make_shared_proxy(R&&... args) : Proxy_base<T>(reinterpret_cast<T*>(data))
+    static Allocate_shared_proxy* create(const A& alloc, R&&... args);
+
+    T* get() noexcept
     {
-        new(Proxy_base<T>::get()) T(std::forward<R>(args)...);
+        return reinterpret_cast<T*>(data);
     };
 };
 
+template<typename T, typename A>
+template<typename... R>
+Allocate_shared_proxy<T, A>* Allocate_shared_proxy<T, A>::create(const A& alloc, R&&... args)
+{
+    Proxy_allocator proxy_alloc(alloc);
+    Allocate_shared_proxy* p = Proxy_traits::allocate(proxy_alloc, 1);
+
+    try
+    {
+        return new(static_cast<void*>(p)) Allocate_shared_proxy(alloc, std::forward<R>(args)...);
+    }
+    catch(...)
+    {
+        Proxy_traits::deallocate(proxy_alloc, p, 1);
+        throw;
+    }
+}
+
+template<typename T, typename A>
+void Allocate_shared_proxy<T, A>::manage(Proxy_base* proxy, Proxy_op op) noexcept
+{
+    Allocate_shared_proxy* self = static_cast<Allocate_shared_proxy*>(proxy);
+
+    instrument<T>(op);
+
+    if(op == Proxy_op::dispose)
+    {
+        Destructor_timer<T> timer(sizeof(T));
+        Object_allocator object_alloc(self->held());
+        Object_traits::destroy(object_alloc, self->get());
+        return;
+    }
+
+    Proxy_allocator proxy_alloc(self->held());
+
+    self->~Allocate_shared_proxy();
+    Proxy_traits::deallocate(proxy_alloc, self, 1);
+}
+
 }
 
 #endif // PROXY_H_INCLUDED
@@ -0,0 +1,295 @@
+#ifndef RELOCATE_H_INCLUDED
+#define RELOCATE_H_INCLUDED
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "smart_ptr.h"
+#include "intrusive_ptr.h"
+
+namespace tuz
+{
+
+//T can be moved to another address by copying its bytes and forgetting the
+//source: nothing points back at the object itself
+template<typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T>
+{
+};
+
+//a handle is two pointers, and the proxy doesn't know where its handles are
+template<typename T>
+struct is_trivially_relocatable<shared_ptr<T>> : std::true_type
+{
+};
+
+template<typename T>
+struct is_trivially_relocatable<weak_ptr<T>> : std::true_type
+{
+};
+
+template<typename T, typename D>
+struct is_trivially_relocatable<unique_ptr<T, D>> : is_trivially_relocatable<D>
+{
+};
+
+template<typename T>
+struct is_trivially_relocatable<intrusive_ptr<T>> : std::true_type
+{
+};
+
+//move-constructs [first, last) into the raw memory at dest and ends the
+//lifetime of the sources; returns the end of the destination range
+template<typename T>
+T* relocate(T* first, T* last, T* dest) noexcept
+{
+    static_assert(is_trivially_relocatable<T>::value || std::is_nothrow_move_constructible<T>::value,
+                  "relocation must not throw halfway");
+
+    if constexpr(is_trivially_relocatable<T>::value)
+    {
+        if(first != last)
+            std::memmove(static_cast<void*>(dest), static_cast<const void*>(first), (last - first) * sizeof(T));
+
+        return dest + (last - first);
+    }
+
+    for(; first != last; ++first, ++dest)
+    {
+        new(dest) T(std::move(*first));
+        first->~T();
+    }
+
+    return dest;
+}
+
+//a minimal vector that grows by relocating its elements, which is a single
+//memcpy for smart pointers instead of a move and a destructor per element.
+//Such buffers are grown with realloc, which can move large blocks by
+//remapping pages instead of copying and faulting in a fresh buffer.
+template<typename T>
+class relocating_vector
+{
+private:
+    static constexpr bool reallocatable = is_trivially_relocatable<T>::value && alignof(T) <= alignof(std::max_align_t);
+
+    T* data_;
+    size_t size_;
+    size_t capacity_;
+
+    relocating_vector(const relocating_vector&) = delete;
+    relocating_vector& operator=(const relocating_vector&) = delete;
+
+    static void deallocate(T* data) noexcept;
+    void grow();
+
+public:
+    relocating_vector() noexcept;
+    relocating_vector(relocating_vector&& rv) noexcept;
+    ~relocating_vector();
+
+    relocating_vector& operator=(relocating_vector&& rv) noexcept;
+
+    void reserve(size_t capacity);
+    void push_back(const T& value);
+    void push_back(T&& value);
+    template<typename... R>
+    T& emplace_back(R&&... args);
+    void pop_back() noexcept;
+    void clear() noexcept;
+    void swap(relocating_vector& rv) noexcept;
+
+    size_t size() const noexcept;
+    size_t capacity() const noexcept;
+    bool empty() const noexcept;
+
+    T& operator[](size_t i) noexcept;
+    const T& operator[](size_t i) const noexcept;
+    T* begin() noexcept;
+    T* end() noexcept;
+    const T* begin() const noexcept;
+    const T* end() const noexcept;
+};
+
+template<typename T>
+relocating_vector<T>::relocating_vector() noexcept :
+data_(nullptr), size_(0), capacity_(0)
+{
+}
+
+template<typename T>
+relocating_vector<T>::relocating_vector(relocating_vector&& rv) noexcept :
+relocating_vector()
+{
+    swap(rv);
+}
+
+template<typename T>
+relocating_vector<T>::~relocating_vector()
+{
+    clear();
+    deallocate(data_);
+}
+
+template<typename T>
+void relocating_vector<T>::deallocate(T* data) noexcept
+{
+    if(reallocatable)
+        std::free(data);
+    else
+        ::operator delete(data, std::align_val_t(alignof(T)));
+}
+
+template<typename T>
+relocating_vector<T>& relocating_vector<T>::operator=(relocating_vector&& rv) noexcept
+{
+    relocating_vector<T>(std::move(rv)).swap(*this);
+    return *this;
+}
+
+template<typename T>
+void relocating_vector<T>::reserve(size_t capacity)
+{
+    if(capacity <= capacity_)
+        return;
+
+    if(capacity > size_t(-1) / sizeof(T))
+        throw std::bad_array_new_length();
+
+    T* fresh;
+
+    if constexpr(reallocatable)
+    {
+        fresh = static_cast<T*>(std::realloc(static_cast<void*>(data_), capacity * sizeof(T)));
+
+        if(!fresh)
+            throw std::bad_alloc();
+    }
+    else
+    {
+        fresh = static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t(alignof(T))));
+
+        relocate(data_, data_ + size_, fresh);
+        deallocate(data_);
+    }
+
+    data_ = fresh;
+    capacity_ = capacity;
+}
+
+template<typename T>
+void relocating_vector<T>::grow()
+{
+    reserve(capacity_ ? 2 * capacity_ : 4);
+}
+
+template<typename T>
+void relocating_vector<T>::push_back(const T& value)
+{
+    emplace_back(value);
+}
+
+template<typename T>
+void relocating_vector<T>::push_back(T&& value)
+{
+    emplace_back(std::move(value));
+}
+
+//the new element is built before growing, so it may refer to an element
+//of this vector
+template<typename T>
+template<typename... R>
+T& relocating_vector<T>::emplace_back(R&&... args)
+{
+    if(size_ == capacity_)
+    {
+        T value(std::forward<R>(args)...);
+        grow();
+        return *new(data_ + size_++) T(std::move(value));
+    }
+
+    return *new(data_ + size_++) T(std::forward<R>(args)...);
+}
+
+template<typename T>
+void relocating_vector<T>::pop_back() noexcept
+{
+    data_[--size_].~T();
+}
+
+template<typename T>
+void relocating_vector<T>::clear() noexcept
+{
+    while(size_)
+        pop_back();
+}
+
+template<typename T>
+void relocating_vector<T>::swap(relocating_vector& rv) noexcept
+{
+    std::swap(data_, rv.data_);
+    std::swap(size_, rv.size_);
+    std::swap(capacity_, rv.capacity_);
+}
+
+template<typename T>
+size_t relocating_vector<T>::size() const noexcept
+{
+    return size_;
+}
+
+template<typename T>
+size_t relocating_vector<T>::capacity() const noexcept
+{
+    return capacity_;
+}
+
+template<typename T>
+bool relocating_vector<T>::empty() const noexcept
+{
+    return !size_;
+}
+
+template<typename T>
+T& relocating_vector<T>::operator[](size_t i) noexcept
+{
+    return data_[i];
+}
+
+template<typename T>
+const T& relocating_vector<T>::operator[](size_t i) const noexcept
+{
+    return data_[i];
+}
+
+template<typename T>
+T* relocating_vector<T>::begin() noexcept
+{
+    return data_;
+}
+
+template<typename T>
+T* relocating_vector<T>::end() noexcept
+{
+    return data_ + size_;
+}
+
+template<typename T>
+const T* relocating_vector<T>::begin() const noexcept
+{
+    return data_;
+}
+
+template<typename T>
+const T* relocating_vector<T>::end() const noexcept
+{
+    return data_ + size_;
+}
+
+}
+
+#endif // RELOCATE_H_INCLUDED
@@ -0,0 +1,305 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "smart_ptr.h"
+#include "atomic_shared_ptr.h"
+
+using namespace tuz;
+
+//Contention of the counters as the number of threads grows. Every pattern
+//runs with 1 to hardware_concurrency threads and reports the throughput
+//of all threads together and the latency percentiles of one operation,
+//taken over the samples of all the threads. Build it with the counting strategy to compare,
+//e.g. -DTUZ_BIASED_REFCOUNT, and diff the JSON reports.
+
+struct Node
+{
+    long value;
+
+    explicit Node(long value) : value(value) {};
+};
+
+//a node that fills two cache lines, so neighbouring proxies never share one
+struct alignas(64) Padded_node
+{
+    long value;
+    char padding[120];
+
+    explicit Padded_node(long value) : value(value) {};
+};
+
+static const int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+static const int max_slots = 256;
+
+//every sample_period-th operation is timed on its own
+static const size_t sample_period = 16;
+
+static int thread_slot(const benchmark::State& state)
+{
+    return state.thread_index() % max_slots;
+}
+
+template<typename F>
+static void sampled_loop(benchmark::State& state, F operation)
+{
+    std::vector<double> samples;
+    size_t i = 0;
+
+    samples.reserve(1 << 16);
+
+    for(auto _ : state)
+    {
+        if(++i % sample_period)
+        {
+            operation();
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        operation();
+        auto finish = std::chrono::steady_clock::now();
+
+        if(samples.size() < samples.capacity())
+            samples.push_back(std::chrono::duration<double, std::nano>(finish - start).count());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+
+    //an average of the percentiles of every thread would hide the tail, so
+    //the threads pool their samples and the last one to finish reports them;
+    //the counters of the threads are summed and only that one sets these
+    static std::mutex pool_mutex;
+    static std::vector<double> pooled;
+    static int pooled_threads = 0;
+
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    pooled.insert(pooled.end(), samples.begin(), samples.end());
+
+    if(++pooled_threads < state.threads())
+        return;
+
+    pooled_threads = 0;
+    samples.swap(pooled);
+    pooled.clear();
+
+    if(samples.empty())
+        return;
+
+    std::sort(samples.begin(), samples.end());
+
+    auto percentile = [&samples](double p)
+    {
+        return benchmark::Counter(samples[size_t(p * (samples.size() - 1))]);
+    };
+
+    state.counters["p50_ns"] = percentile(0.5);
+    state.counters["p99_ns"] = percentile(0.99);
+    state.counters["p999_ns"] = percentile(0.999);
+}
+
+//pins the calling thread to one core for the lifetime of the guard; the
+//benchmark library runs thread 0 on the main thread, so the old mask is
+//restored afterwards
+class Pinned_thread
+{
+private:
+#ifdef __linux__
+    cpu_set_t old_mask;
+    bool pinned = false;
+#endif
+
+public:
+    explicit Pinned_thread(int cpu)
+    {
+#ifdef __linux__
+        cpu_set_t mask;
+
+        CPU_ZERO(&mask);
+        CPU_SET(cpu % max_threads, &mask);
+
+        pinned = !pthread_getaffinity_np(pthread_self(), sizeof(old_mask), &old_mask) &&
+            !pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+#endif
+    };
+
+    ~Pinned_thread()
+    {
+#ifdef __linux__
+        if(pinned)
+            pthread_setaffinity_np(pthread_self(), sizeof(old_mask), &old_mask);
+#endif
+    };
+};
+
+//all threads copy and drop links to one object
+static shared_ptr<Node> hot_object;
+
+static void hot_copy(benchmark::State& state)
+{
+    if(state.thread_index() == 0)
+        hot_object = make_shared<Node>(1);
+
+    sampled_loop(state, []()
+    {
+        shared_ptr<Node> copy(hot_object);
+        benchmark::DoNotOptimize(copy.get());
+    });
+
+    if(state.thread_index() == 0)
+        hot_object.reset();
+}
+
+static void BM_hot_copy(benchmark::State& state)
+{
+    hot_copy(state);
+}
+BENCHMARK(BM_hot_copy)->ThreadRange(1, max_threads)->UseRealTime();
+
+static void BM_hot_copy_pinned(benchmark::State& state)
+{
+    Pinned_thread pin(state.thread_index());
+    hot_copy(state);
+}
+BENCHMARK(BM_hot_copy_pinned)->ThreadRange(1, max_threads)->UseRealTime();
+
+//every thread copies links to its own object. The adjacent objects come
+//from one burst of allocations, so their proxies share cache lines; the
+//padded ones don't. The gap between the two is false sharing.
+static std::vector<shared_ptr<Node>> adjacent_objects;
+static std::vector<shared_ptr<Padded_node>> padded_objects;
+
+template<typename T>
+static void per_thread_copy(benchmark::State& state, std::vector<shared_ptr<T>>& objects)
+{
+    if(state.thread_index() == 0)
+        for(int i = 0; i < max_slots; ++i)
+            objects.push_back(make_shared<T>(i));
+
+    int slot = thread_slot(state);
+
+    //thread 0 may still be filling objects until the loop starts
+    sampled_loop(state, [&objects, slot]()
+    {
+        shared_ptr<T> copy(objects[slot]);
+        benchmark::DoNotOptimize(copy.get());
+    });
+
+    if(state.thread_index() == 0)
+        objects.clear();
+}
+
+static void BM_per_thread_adjacent(benchmark::State& state)
+{
+    per_thread_copy(state, adjacent_objects);
+}
+BENCHMARK(BM_per_thread_adjacent)->ThreadRange(1, max_threads)->UseRealTime();
+
+static void BM_per_thread_padded(benchmark::State& state)
+{
+    per_thread_copy(state, padded_objects);
+}
+BENCHMARK(BM_per_thread_padded)->ThreadRange(1, max_threads)->UseRealTime();
+
+static void BM_per_thread_adjacent_pinned(benchmark::State& state)
+{
+    Pinned_thread pin(state.thread_index());
+    per_thread_copy(state, adjacent_objects);
+}
+BENCHMARK(BM_per_thread_adjacent_pinned)->ThreadRange(1, max_threads)->UseRealTime();
+
+//pairs of threads hand objects over through one slot: even threads create
+//them, odd threads take them and drop the last link. A lone thread does both.
+static atomic_shared_ptr<Node> handoff_slots[max_slots / 2];
+
+static void BM_handoff(benchmark::State& state)
+{
+    int slot = thread_slot(state);
+    atomic_shared_ptr<Node>& handoff = handoff_slots[slot / 2];
+    bool producer = slot % 2 == 0;
+    bool consumer = slot % 2 == 1 || state.threads() == 1;
+    long i = 0;
+
+    sampled_loop(state, [&]()
+    {
+        if(producer)
+            handoff.store(make_shared<Node>(++i));
+
+        if(consumer)
+            benchmark::DoNotOptimize(handoff.exchange(shared_ptr<Node>()).get());
+    });
+
+    if(state.thread_index() == 0)
+        for(atomic_shared_ptr<Node>& h : handoff_slots)
+            h.store(shared_ptr<Node>());
+}
+BENCHMARK(BM_handoff)->ThreadRange(1, max_threads)->UseRealTime();
+
+//a cache of weak_ptrs in front of owners elsewhere: lookups lock a skewed
+//mix of entries, so a few hot entries take most of the traffic, and one
+//lookup in 64 misses on an expired entry
+static const size_t cache_size = 1024;
+static std::vector<shared_ptr<Node>> cache_owners;
+static std::vector<weak_ptr<Node>> cache;
+
+static void BM_weak_cache(benchmark::State& state)
+{
+    if(state.thread_index() == 0)
+    {
+        for(size_t i = 0; i < cache_size; ++i)
+        {
+            cache_owners.push_back(make_shared<Node>(long(i)));
+            cache.emplace_back(cache_owners.back());
+        }
+
+        for(size_t i = 0; i < cache_size; i += 64)
+            cache_owners[i].reset();
+    }
+
+    std::mt19937 random(228 + state.thread_index());
+    std::geometric_distribution<size_t> skew(0.05);
+    std::vector<size_t> keys(4096);
+
+    for(size_t& key : keys)
+        key = skew(random) % cache_size;
+
+    size_t i = 0;
+
+    sampled_loop(state, [&]()
+    {
+        shared_ptr<Node> hit = cache[keys[++i % keys.size()]].lock();
+        benchmark::DoNotOptimize(hit.get());
+    });
+
+    if(state.thread_index() == 0)
+    {
+        cache.clear();
+        cache_owners.clear();
+    }
+}
+BENCHMARK(BM_weak_cache)->ThreadRange(1, max_threads)->UseRealTime();
+
+//empty handles have no proxy, so these should scale like plain stores
+static void BM_empty_copy(benchmark::State& state)
+{
+    static shared_ptr<Node> empty;
+
+    sampled_loop(state, []()
+    {
+        shared_ptr<Node> copy(empty);
+        benchmark::DoNotOptimize(copy.get());
+    });
+}
+BENCHMARK(BM_empty_copy)->ThreadRange(1, max_threads)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -2,6 +2,7 @@
 #define SHARED_PTR_H_INCLUDED
 
 #include <algorithm>
+#include <new>
 #include <type_traits>
 
 #include "smart_ptr.h"
@@ -10,76 +11,192 @@
 namespace tuz
 {
 
+//the proxy is new, so its weak link goes straight into the helper without
+//a temporary weak_ptr or an atomic increment. An object that still has a
+//live owner keeps it.
 template<typename T>
-void shared_ptr<T>::wp_init_helper(enable_shared_from_this<T>* ptr) noexcept
+template<typename U>
+void shared_ptr<T>::wp_init_helper(enable_shared_from_this<U>* esft) noexcept
 {
-    ptr->wp_helper = weak_ptr<T>(*this);
+    weak_ptr<U>& helper = esft->wp_helper;
+    Proxy_base* proxy = SW_base<T, shared_ptr>::proxy;
+
+    if(helper.proxy)
+    {
+        if(!helper.proxy->expired())
+            return;
+
+        helper.check_out();
+    }
+
+    helper.adopt_proxy(proxy, SW_base<T, shared_ptr>::ptr);
+    proxy->check_in_unshared(Identity<weak_ptr<U>>());
 }
 
 template<typename T>
 template<typename D>
-shared_ptr<T>::shared_ptr(T* ptr, const D& deleter)
+shared_ptr<T>::shared_ptr(element_type* ptr, D deleter)
 {
-    make_proxy(ptr, deleter);
+    make_proxy(ptr, std::move(deleter));
 }
 
 template<typename T>
-shared_ptr<T>::shared_ptr() noexcept
+template<typename D, typename A>
+shared_ptr<T>::shared_ptr(element_type* ptr, D deleter, const A& alloc)
 {
-    make_proxy();
+    make_proxy(ptr, std::move(deleter), alloc);
 }
 
 template<typename T>
-shared_ptr<T>::shared_ptr(shared_ptr<T>&& sp) noexcept :
-shared_ptr()
+constexpr shared_ptr<T>::shared_ptr() noexcept
+{
+}
+
+template<typename T>
+constexpr shared_ptr<T>::shared_ptr(std::nullptr_t) noexcept
 {
-    SW_base<T, shared_ptr>::swap(sp);
 }
 
+//moves hand the link over and never touch the counters
 template<typename T>
-void shared_ptr<T>::set_new_proxy(Proxy_base<T>* p) noexcept
+shared_ptr<T>::shared_ptr(shared_ptr<T>&& sp) noexcept
 {
-    SW_base<T, shared_ptr>::set_proxy(p);
+    SW_base<T, shared_ptr>::adopt_proxy(sp.proxy, sp.ptr);
+    sp.adopt_proxy(nullptr, nullptr);
+}
+
+template<typename T>
+template<typename U, typename>
+shared_ptr<T>::shared_ptr(const shared_ptr<U>& sp) noexcept
+{
+    SW_base<T, shared_ptr>::set_proxy(sp.proxy, sp.ptr);
+}
 
-    wp_init_helper(SW_base<T, shared_ptr>::proxy->get());
+template<typename T>
+template<typename U, typename>
+shared_ptr<T>::shared_ptr(shared_ptr<U>&& sp) noexcept
+{
+    SW_base<T, shared_ptr>::adopt_proxy(sp.proxy, sp.ptr);
+    sp.adopt_proxy(nullptr, nullptr);
+}
+
+template<typename T>
+template<typename U>
+shared_ptr<T>::shared_ptr(const shared_ptr<U>& sp, element_type* ptr) noexcept
+{
+    SW_base<T, shared_ptr>::set_proxy(sp.proxy, ptr);
+}
+
+template<typename T>
+template<typename U>
+shared_ptr<T>::shared_ptr(shared_ptr<U>&& sp, element_type* ptr) noexcept
+{
+    SW_base<T, shared_ptr>::adopt_proxy(sp.proxy, ptr);
+    sp.adopt_proxy(nullptr, nullptr);
+}
+
+template<typename T>
+void shared_ptr<T>::set_new_proxy(Proxy_base* p, element_type* ptr) noexcept
+{
+    SW_base<T, shared_ptr>::set_proxy(p, ptr);
+
+    //the elements of an array don't own each other
+    if constexpr(!std::is_array<T>::value)
+        wp_init_helper(ptr);
 }
 
 template<typename T>
 template<typename D>
-void shared_ptr<T>::make_proxy(T* ptr, const D& deleter)
+void shared_ptr<T>::make_proxy(element_type* ptr, D deleter)
 {
-    if(ptr)
-        set_new_proxy(new Proxy_deleter<T, D>(ptr, deleter));
-    else
+    if(!ptr)
+    {
         SW_base<T, shared_ptr>::set_proxy();
+        return;
+    }
+
+    Proxy_deleter<element_type, D>* p;
+
+    try
+    {
+        p = new Proxy_deleter<element_type, D>(ptr, std::move(deleter));
+    }
+    catch(...)
+    {
+        deleter(ptr);
+        throw;
+    }
+
+    set_new_proxy(p, ptr);
 }
 
 template<typename T>
-shared_ptr<T>::shared_ptr(Proxy_base<T>& p) noexcept
+template<typename D, typename A>
+void shared_ptr<T>::make_proxy(element_type* ptr, D deleter, const A& alloc)
 {
-    set_new_proxy(&p);
+    if(!ptr)
+    {
+        SW_base<T, shared_ptr>::set_proxy();
+        return;
+    }
+
+    Proxy_deleter_alloc<element_type, D, A>* p;
+
+    try
+    {
+        p = Proxy_deleter_alloc<element_type, D, A>::create(ptr, std::move(deleter), alloc);
+    }
+    catch(...)
+    {
+        deleter(ptr);
+        throw;
+    }
+
+    set_new_proxy(p, ptr);
+}
+
+template<typename T>
+shared_ptr<T>::shared_ptr(Proxy_base& p, element_type* ptr) noexcept
+{
+    set_new_proxy(&p, ptr);
+}
+
+template<typename T>
+shared_ptr<T>::shared_ptr(Proxy_base& p, element_type* ptr, Adopt_link) noexcept
+{
+    SW_base<T, shared_ptr>::adopt_proxy(&p, ptr);
 }
 
 template<typename T>
 shared_ptr<T>::shared_ptr(const shared_ptr& sp) noexcept
 {
-    SW_base<T, shared_ptr>::set_proxy(sp.proxy);
+    SW_base<T, shared_ptr>::set_proxy(sp.proxy, sp.ptr);
 }
 
 template<typename T>
-shared_ptr<T>::shared_ptr(const weak_ptr<T>& wp)
+template<typename U, typename>
+shared_ptr<T>::shared_ptr(const weak_ptr<U>& wp)
 {
-    if(wp.proxy->expired())
+    if(!wp.proxy || !wp.proxy->try_check_in(Identity<shared_ptr>()))
         throw bad_weak_ptr();
-    else
-        SW_base<T, shared_ptr>::set_proxy(wp.proxy);
+
+    profile_link<shared_ptr>(Link_event::check_in);
+    SW_base<T, shared_ptr>::adopt_proxy(wp.proxy, wp.ptr);
 }
 
+//unlike the constructor from a pointer, a failure leaves the object with up
 template<typename T>
 template<typename D>
-shared_ptr<T>::shared_ptr(unique_ptr<T, D>&& up) : shared_ptr(up.get(), up.get_deleter())
+shared_ptr<T>::shared_ptr(unique_ptr<T, D>&& up)
 {
-    up.release();
+    typedef typename std::remove_reference<D>::type Deleter;
+
+    if(!up)
+        return;
+
+    Proxy_deleter<element_type, Deleter>* p = new Proxy_deleter<element_type, Deleter>(up.get(), std::move(up.get_deleter()));
+
+    set_new_proxy(p, up.release());
 }
 
 template<typename T>
@@ -91,8 +208,7 @@ shared_ptr<T>::~shared_ptr()
 template<typename T>
 shared_ptr<T>& shared_ptr<T>::operator=(shared_ptr&& sp) noexcept
 {
-    SW_base<T, shared_ptr>::swap(sp);
-    sp.reset();
+    shared_ptr<T>(std::move(sp)).swap(*this);
     return *this;
 }
 
@@ -110,50 +226,59 @@ template<typename T>
 template<typename D>
 shared_ptr<T>& shared_ptr<T>::operator=(unique_ptr<T, D>&& up)
 {
-    SW_base<T, shared_ptr>::check_out();
-    make_proxy(up.get(), up.get_deleter());
-
-    up.release();
-
+    //the old link goes only once the new owner exists
+    shared_ptr<T>(std::move(up)).swap(*this);
     return *this;
 }
 
 template<typename T>
 template<typename D>
-void shared_ptr<T>::reset(T* ptr, const D& deleter)
+void shared_ptr<T>::reset(element_type* ptr, D deleter)
 {
-    SW_base<T, shared_ptr>::check_out();
-    make_proxy(ptr, deleter);
+    shared_ptr<T>(ptr, std::move(deleter)).swap(*this);
+}
+
+template<typename T>
+template<typename D, typename A>
+void shared_ptr<T>::reset(element_type* ptr, D deleter, const A& alloc)
+{
+    shared_ptr<T>(ptr, std::move(deleter), alloc).swap(*this);
+}
+
+template<typename T>
+void shared_ptr<T>::swap(shared_ptr& sp) noexcept
+{
+    SW_base<T, shared_ptr>::swap(sp);
 }
 
 template<typename T>
 bool shared_ptr<T>::operator==(const shared_ptr& sp) const noexcept
 {
-    return SW_base<T, shared_ptr>::proxy->get() == sp.proxy->get();
+    return SW_base<T, shared_ptr>::ptr == sp.ptr;
 }
 
 template<typename T>
 bool shared_ptr<T>::operator<=(const shared_ptr& sp) const noexcept
 {
-    return SW_base<T, shared_ptr>::proxy->get() <= sp.proxy->get();
+    return SW_base<T, shared_ptr>::ptr <= sp.ptr;
 }
 
 template<typename T>
 bool shared_ptr<T>::operator>=(const shared_ptr& sp) const noexcept
 {
-    return SW_base<T, shared_ptr>::proxy->get() >= sp.proxy->get();
+    return SW_base<T, shared_ptr>::ptr >= sp.ptr;
 }
 
 template<typename T>
 bool shared_ptr<T>::operator<(const shared_ptr& sp) const noexcept
 {
-    return SW_base<T, shared_ptr>::proxy->get() < sp.proxy->get();
+    return SW_base<T, shared_ptr>::ptr < sp.ptr;
 }
 
 template<typename T>
 bool shared_ptr<T>::operator>(const shared_ptr& sp) const noexcept
 {
-    return SW_base<T, shared_ptr>::proxy->get() > sp.proxy->get();
+    return SW_base<T, shared_ptr>::ptr > sp.ptr;
 }
 
 template<typename T>
@@ -163,35 +288,158 @@ bool shared_ptr<T>::operator!=(const shared_ptr& sp) const noexcept
 }
 
 template<typename T>
-T& shared_ptr<T>::operator*() const noexcept
+typename shared_ptr<T>::element_type& shared_ptr<T>::operator*() const noexcept
+{
+    return *SW_base<T, shared_ptr>::ptr;
+}
+
+template<typename T>
+typename shared_ptr<T>::element_type* shared_ptr<T>::operator->() const noexcept
 {
-    return *SW_base<T, shared_ptr>::proxy->get();
+    return SW_base<T, shared_ptr>::ptr;
 }
 
 template<typename T>
-T* shared_ptr<T>::operator->() const noexcept
+typename shared_ptr<T>::element_type& shared_ptr<T>::operator[](ptrdiff_t i) const noexcept
 {
-    return SW_base<T, shared_ptr>::proxy->get();
+    return SW_base<T, shared_ptr>::ptr[i];
 }
 
 template<typename T>
 shared_ptr<T>::operator bool() const noexcept
 {
-    return SW_base<T, shared_ptr>::proxy->get() != nullptr;
+    return SW_base<T, shared_ptr>::ptr != nullptr;
 }
 
 template<typename T>
-T* shared_ptr<T>::get() const noexcept
+typename shared_ptr<T>::element_type* shared_ptr<T>::get() const noexcept
 {
-    return SW_base<T, shared_ptr>::proxy->get();
+    return SW_base<T, shared_ptr>::ptr;
 }
 
 template<typename T, typename... R>
-shared_ptr<T> make_shared(R&&... args)
+Enable_if_not_array<T, shared_ptr<T>> make_shared(R&&... args)
 {
-    Proxy_base<T>* pb = new Make_shared_proxy<T>(std::forward<R>(args)...);
+    Make_shared_proxy<T>* pb = new Make_shared_proxy<T>(std::forward<R>(args)...);
 
-    return shared_ptr<T>(*pb);
+    return shared_ptr<T>(*pb, pb->get());
+}
+
+template<typename T>
+Enable_if_not_array<T, shared_ptr<T>> make_shared_for_overwrite()
+{
+    Make_shared_proxy<T>* pb = new Make_shared_proxy<T>(For_overwrite());
+
+    return shared_ptr<T>(*pb, pb->get());
+}
+
+//the elements of a multidimensional array are laid out as one row of
+//scalars; the pattern (one element) is repeated over that row
+template<typename T>
+shared_ptr<T> make_shared_array(size_t count, const typename std::remove_all_extents<T>::type* pattern, size_t pattern_size, bool overwrite)
+{
+    typedef typename std::remove_all_extents<T>::type Scalar;
+    typedef typename shared_ptr<T>::element_type Element;
+
+    const size_t scalars_per_element = sizeof(Element) / sizeof(Scalar);
+
+    if(count > size_t(-1) / sizeof(Element))
+        throw std::bad_array_new_length();
+
+    Make_shared_array_proxy<Scalar>* pb =
+        Make_shared_array_proxy<Scalar>::create(count * scalars_per_element, pattern, pattern_size, overwrite);
+
+    return shared_ptr<T>(*pb, reinterpret_cast<Element*>(pb->get()));
+}
+
+template<typename T>
+Enable_if_unbounded_array<T, shared_ptr<T>> make_shared(size_t count)
+{
+    return make_shared_array<T>(count, nullptr, 0, false);
+}
+
+template<typename T>
+Enable_if_unbounded_array<T, shared_ptr<T>> make_shared(size_t count, const typename std::remove_extent<T>::type& value)
+{
+    typedef typename std::remove_all_extents<T>::type Scalar;
+
+    return make_shared_array<T>(count, reinterpret_cast<const Scalar*>(&value), sizeof(value) / sizeof(Scalar), false);
+}
+
+template<typename T>
+Enable_if_bounded_array<T, shared_ptr<T>> make_shared()
+{
+    return make_shared_array<T>(std::extent<T>::value, nullptr, 0, false);
+}
+
+template<typename T>
+Enable_if_bounded_array<T, shared_ptr<T>> make_shared(const typename std::remove_extent<T>::type& value)
+{
+    typedef typename std::remove_all_extents<T>::type Scalar;
+
+    return make_shared_array<T>(std::extent<T>::value, reinterpret_cast<const Scalar*>(&value), sizeof(value) / sizeof(Scalar), false);
+}
+
+//the elements are left default-initialized: large numeric buffers
+//aren't zeroed only to be overwritten right away
+template<typename T>
+Enable_if_unbounded_array<T, shared_ptr<T>> make_shared_for_overwrite(size_t count)
+{
+    return make_shared_array<T>(count, nullptr, 0, true);
+}
+
+template<typename T>
+Enable_if_bounded_array<T, shared_ptr<T>> make_shared_for_overwrite()
+{
+    return make_shared_array<T>(std::extent<T>::value, nullptr, 0, true);
+}
+
+//for objects that are read by many threads while their owners come and go:
+//link counting doesn't invalidate the cache line the readers use
+template<typename T, typename... R>
+shared_ptr<T> make_shared_cache_aligned(R&&... args)
+{
+    Make_shared_proxy<T, cache_line_size>* pb = new Make_shared_proxy<T, cache_line_size>(std::forward<R>(args)...);
+
+    return shared_ptr<T>(*pb, pb->get());
+}
+
+//the proxy and the object share one allocation from alloc,
+//std::pmr::polymorphic_allocator included
+template<typename T, typename A, typename... R>
+shared_ptr<T> allocate_shared(const A& alloc, R&&... args)
+{
+    Allocate_shared_proxy<T, A>* pb = Allocate_shared_proxy<T, A>::create(alloc, std::forward<R>(args)...);
+
+    return shared_ptr<T>(*pb, pb->get());
+}
+
+//the casts share the proxy of sp and never allocate
+template<typename T, typename U>
+shared_ptr<T> static_pointer_cast(const shared_ptr<U>& sp) noexcept
+{
+    return shared_ptr<T>(sp, static_cast<typename shared_ptr<T>::element_type*>(sp.get()));
+}
+
+template<typename T, typename U>
+shared_ptr<T> dynamic_pointer_cast(const shared_ptr<U>& sp) noexcept
+{
+    if(typename shared_ptr<T>::element_type* ptr = dynamic_cast<typename shared_ptr<T>::element_type*>(sp.get()))
+        return shared_ptr<T>(sp, ptr);
+    else
+        return shared_ptr<T>();
+}
+
+template<typename T, typename U>
+shared_ptr<T> const_pointer_cast(const shared_ptr<U>& sp) noexcept
+{
+    return shared_ptr<T>(sp, const_cast<typename shared_ptr<T>::element_type*>(sp.get()));
+}
+
+template<typename T, typename U>
+shared_ptr<T> reinterpret_pointer_cast(const shared_ptr<U>& sp) noexcept
+{
+    return shared_ptr<T>(sp, reinterpret_cast<typename shared_ptr<T>::element_type*>(sp.get()));
 }
 
 }
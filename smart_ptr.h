@@ -31,36 +31,99 @@ namespace tuz
 {
 
 template<typename T, typename... R>
-shared_ptr<T> make_shared(R&&... args);
+Enable_if_not_array<T, shared_ptr<T>> make_shared(R&&... args);
+
+template<typename T>
+Enable_if_not_array<T, shared_ptr<T>> make_shared_for_overwrite();
+
+template<typename T>
+shared_ptr<T> make_shared_array(size_t count, const typename std::remove_all_extents<T>::type* pattern, size_t pattern_size, bool overwrite);
+
+template<typename T, typename... R>
+shared_ptr<T> make_shared_cache_aligned(R&&... args);
+
+template<typename T, typename A, typename... R>
+shared_ptr<T> allocate_shared(const A& alloc, R&&... args);
+
+template<typename T, typename... R>
+Enable_if_not_array<T, shared_ptr<T>> make_shared_deferred(R&&... args);
+
+template<typename T, typename... R>
+Enable_if_not_array<T, shared_ptr<T>> make_shared_collectable(R&&... args);
 
 template<typename T>
 class enable_shared_from_this;
 
+template<typename T>
+class atomic_shared_ptr;
+
+template<typename T>
+class local_shared_ptr;
+
 template<typename T>
 class shared_ptr : public SW_base<T, shared_ptr<T>>
 {
     template<typename U, typename... R>
-    friend shared_ptr<U> make_shared(R&&... args);
+    friend Enable_if_not_array<U, shared_ptr<U>> make_shared(R&&... args);
+    template<typename U>
+    friend Enable_if_not_array<U, shared_ptr<U>> make_shared_for_overwrite();
+    template<typename U>
+    friend shared_ptr<U> make_shared_array(size_t count, const typename std::remove_all_extents<U>::type* pattern, size_t pattern_size, bool overwrite);
+    template<typename U, typename... R>
+    friend shared_ptr<U> make_shared_cache_aligned(R&&... args);
+    template<typename U, typename A, typename... R>
+    friend shared_ptr<U> allocate_shared(const A& alloc, R&&... args);
+    template<typename U, typename... R>
+    friend Enable_if_not_array<U, shared_ptr<U>> make_shared_deferred(R&&... args);
+    template<typename U, typename... R>
+    friend Enable_if_not_array<U, shared_ptr<U>> make_shared_collectable(R&&... args);
+    friend class cycle_tracer;
 
-    friend void std::swap<T>(shared_ptr& sp_a, shared_ptr& sp_b) noexcept;
-    friend weak_ptr<T>;
+    template<typename U>
+    friend class shared_ptr;
+    template<typename U>
+    friend class weak_ptr;
+    friend atomic_shared_ptr<T>;
+    friend local_shared_ptr<T>;
+
+public:
+    typedef typename SW_base<T, shared_ptr>::element_type element_type;
 
 private:
-    void wp_init_helper(enable_shared_from_this<T>* ptr) noexcept;
+    //T[N] is released with delete[] too
+    typedef default_delete<typename std::conditional<std::is_array<T>::value, element_type[], T>::type> Default_deleter;
+
+    template<typename U>
+    void wp_init_helper(enable_shared_from_this<U>* esft) noexcept;
     void wp_init_helper(...) noexcept {};
 
-    template<typename D = default_delete<T>>
-    void make_proxy(T* ptr = nullptr, const D& deleter = default_delete<T>());
-    void set_new_proxy(Proxy_base<T>* p) noexcept;
-    shared_ptr(Proxy_base<T>& p) noexcept;
+    template<typename D = Default_deleter>
+    void make_proxy(element_type* ptr = nullptr, D deleter = D());
+    template<typename D, typename A>
+    void make_proxy(element_type* ptr, D deleter, const A& alloc);
+    void set_new_proxy(Proxy_base* p, element_type* ptr) noexcept;
+    shared_ptr(Proxy_base& p, element_type* ptr) noexcept;
+    shared_ptr(Proxy_base& p, element_type* ptr, Adopt_link) noexcept;
 
 public:
-    shared_ptr() noexcept;
-    template<typename D = default_delete<T>>
-    explicit shared_ptr(T* ptr, const D& deleter = default_delete<T>());
+    constexpr shared_ptr() noexcept;
+    constexpr shared_ptr(std::nullptr_t) noexcept;
+    template<typename D = Default_deleter>
+    explicit shared_ptr(element_type* ptr, D deleter = D());
+    template<typename D, typename A>
+    shared_ptr(element_type* ptr, D deleter, const A& alloc);
     shared_ptr(const shared_ptr& sp) noexcept;
     shared_ptr(shared_ptr&& sp) noexcept;
-    explicit shared_ptr(const weak_ptr<T>& wp);
+    template<typename U, typename = Enable_if_convertible<U, T>>
+    shared_ptr(const shared_ptr<U>& sp) noexcept;
+    template<typename U, typename = Enable_if_convertible<U, T>>
+    shared_ptr(shared_ptr<U>&& sp) noexcept;
+    template<typename U>
+    shared_ptr(const shared_ptr<U>& sp, element_type* ptr) noexcept;
+    template<typename U>
+    shared_ptr(shared_ptr<U>&& sp, element_type* ptr) noexcept;
+    template<typename U, typename = Enable_if_convertible<U, T>>
+    explicit shared_ptr(const weak_ptr<U>& wp);
     template<typename D>
     shared_ptr(unique_ptr<T, D>&& up);
     ~shared_ptr();
@@ -70,13 +133,17 @@ public:
     template<typename D>
     shared_ptr& operator=(unique_ptr<T, D>&& up);
 
-    template<typename D = default_delete<T>>
-    void reset(T* ptr = nullptr, const D& deleter = default_delete<T>());
+    template<typename D = Default_deleter>
+    void reset(element_type* ptr = nullptr, D deleter = D());
+    template<typename D, typename A>
+    void reset(element_type* ptr, D deleter, const A& alloc);
+    void swap(shared_ptr& sp) noexcept;
 
-    T& operator*() const noexcept;
-    T* operator->() const noexcept;
+    element_type& operator*() const noexcept;
+    element_type* operator->() const noexcept;
+    element_type& operator[](ptrdiff_t i) const noexcept;
     operator bool() const noexcept;
-    T* get() const noexcept;
+    element_type* get() const noexcept;
 
     bool operator==(const shared_ptr& sp) const noexcept;
     bool operator<=(const shared_ptr& sp) const noexcept;
@@ -90,41 +157,65 @@ public:
 template<typename T>
 class weak_ptr : public SW_base<T, weak_ptr<T>>
 {
-    friend void std::swap<T>(weak_ptr& sp_a, weak_ptr& sp_b) noexcept;
-    friend shared_ptr<T>;
+    template<typename U>
+    friend class shared_ptr;
+    template<typename U>
+    friend class weak_ptr;
 
 public:
-    weak_ptr() noexcept;
+    constexpr weak_ptr() noexcept;
     weak_ptr(const weak_ptr& wp) noexcept;
-    weak_ptr(const shared_ptr<T>& sp) noexcept;
+    weak_ptr(weak_ptr&& wp) noexcept;
+    template<typename U, typename = Enable_if_convertible<U, T>>
+    weak_ptr(const weak_ptr<U>& wp) noexcept;
+    template<typename U, typename = Enable_if_convertible<U, T>>
+    weak_ptr(const shared_ptr<U>& sp) noexcept;
     ~weak_ptr();
 
     weak_ptr& operator=(const weak_ptr& wp) noexcept;
-    weak_ptr& operator=(const shared_ptr<T>& sp) noexcept;
+    weak_ptr& operator=(weak_ptr&& wp) noexcept;
+    template<typename U>
+    weak_ptr& operator=(const shared_ptr<U>& sp) noexcept;
 
     void reset() noexcept;
+    void swap(weak_ptr& wp) noexcept;
 
 #ifdef DEBUG
     size_t DEBUG_weak_links_count() const noexcept
     {
-        return SW_base<T, weak_ptr>::proxy->DEBUG_weak_links_count();
+        Proxy_base* proxy = SW_base<T, weak_ptr>::proxy;
+
+        return proxy ? proxy->DEBUG_weak_links_count() : 0;
     };
 #endif
 
-    shared_ptr<T> lock() const;
+    shared_ptr<T> lock() const noexcept;
 };
 
 
+//a copy of the object is not owned by the owners of the original
 template<typename T>
 class enable_shared_from_this
 {
-    friend shared_ptr<T>;
+    template<typename U>
+    friend class shared_ptr;
 
 private:
     weak_ptr<T> wp_helper;
 
+protected:
+    constexpr enable_shared_from_this() noexcept;
+    enable_shared_from_this(const enable_shared_from_this& esft) noexcept;
+    ~enable_shared_from_this() = default;
+
+    enable_shared_from_this& operator=(const enable_shared_from_this& esft) noexcept;
+
 public:
+    //throws bad_weak_ptr when no shared_ptr owns the object
     shared_ptr<T> shared_from_this() const;
+    //empty when no shared_ptr owns the object
+    shared_ptr<T> try_shared_from_this() const noexcept;
+    weak_ptr<T> weak_from_this() const noexcept;
 };
 
 }
@@ -0,0 +1,106 @@
+#ifndef TEARDOWN_H_INCLUDED
+#define TEARDOWN_H_INCLUDED
+
+#include <cstddef>
+#include <new>
+
+//how many objects a thread destroys inside one another before it puts the
+//rest of a chain on its worklist
+#ifndef TUZ_TEARDOWN_DEPTH_LIMIT
+#define TUZ_TEARDOWN_DEPTH_LIMIT 256
+#endif
+
+namespace tuz
+{
+
+class Proxy_base;
+
+//Dropping the last link to the head of a list destroys the next node from
+//the destructor of the head, and so on down the chain. Every thread counts
+//how deep it is in such destructors; past TUZ_TEARDOWN_DEPTH_LIMIT the
+//proxies go on a worklist, and the outermost release destroys them one by
+//one, so any chain is freed in bounded stack space.
+//The worklist is a stack of chunks that only exist during a deep teardown.
+class Teardown_list
+{
+private:
+    struct Chunk
+    {
+        static constexpr size_t capacity = 254;
+
+        Chunk* next;
+        size_t count;
+        Proxy_base* proxies[capacity];
+    };
+
+    //trivially destructible, so it stays usable while the thread exits
+    struct State
+    {
+        size_t depth;
+        Chunk* chunks;
+    };
+
+    static State& state() noexcept;
+
+public:
+    static size_t& depth() noexcept;
+    //false when the worklist can't grow, the caller then recurses
+    static bool push(Proxy_base* proxy) noexcept;
+    //null once the worklist is empty
+    static Proxy_base* pop() noexcept;
+};
+
+inline Teardown_list::State& Teardown_list::state() noexcept
+{
+    static thread_local State the_state;
+    return the_state;
+}
+
+inline size_t& Teardown_list::depth() noexcept
+{
+    return state().depth;
+}
+
+inline bool Teardown_list::push(Proxy_base* proxy) noexcept
+{
+    State& s = state();
+
+    if(!s.chunks || s.chunks->count == Chunk::capacity)
+    {
+        Chunk* chunk = new(std::nothrow) Chunk;
+
+        if(!chunk)
+            return false;
+
+        chunk->next = s.chunks;
+        chunk->count = 0;
+        s.chunks = chunk;
+    }
+
+    s.chunks->proxies[s.chunks->count++] = proxy;
+
+    return true;
+}
+
+inline Proxy_base* Teardown_list::pop() noexcept
+{
+    State& s = state();
+    Chunk* chunk = s.chunks;
+
+    if(!chunk)
+        return nullptr;
+
+    Proxy_base* proxy = chunk->proxies[--chunk->count];
+
+    if(!chunk->count)
+    {
+        s.chunks = chunk->next;
+        delete chunk;
+    }
+
+    return proxy;
+}
+
+}
+
+#endif // TEARDOWN_H_INCLUDED
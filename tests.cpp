@@ -1,8 +1,22 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory_resource>
+#include <stdexcept>
 
 #include "tests.h"
 #include "smart_ptr.h"
+#include "atomic_shared_ptr.h"
+#include "relocate.h"
+#include "local_shared_ptr.h"
+#include "intrusive_ptr.h"
+#include "deferred.h"
+#include "cycles.h"
+#include "track.h"
 #include "exception.h"
 
 using namespace tuz;
@@ -37,6 +51,105 @@ public:
     explicit Esft_test(int var) : var(var) {};
 };
 
+template<typename Policy>
+class Intrusive_test : public intrusive_ref_counter<Intrusive_test<Policy>, Policy>
+{
+private:
+    int* counter;
+
+public:
+    int var;
+
+    explicit Intrusive_test(int* counter, int var = 228) : counter(counter), var(var) {};
+    virtual ~Intrusive_test()
+    {
+        ++*counter;
+    };
+};
+
+class Intrusive_derived : public Intrusive_test<default_counter>
+{
+public:
+    explicit Intrusive_derived(int* counter) : Intrusive_test<default_counter>(counter, 1) {};
+};
+
+class Esft_derived : public Esft_test
+{
+public:
+    explicit Esft_derived(int var) : Esft_test(var) {};
+};
+
+class Base
+{
+public:
+    int base_field;
+
+    Base() : base_field(1) {};
+    virtual ~Base() = default;
+};
+
+class Derived : public Base
+{
+private:
+    int* counter;
+
+public:
+    int derived_field;
+
+    explicit Derived(int* counter) : counter(counter), derived_field(2) {};
+    ~Derived()
+    {
+        ++*counter;
+    };
+};
+
+struct alignas(64) Simd_payload
+{
+    float lanes[16];
+};
+
+struct Array_element
+{
+    int* counter = nullptr;
+
+    ~Array_element()
+    {
+        if(counter)
+            ++*counter;
+    };
+};
+
+template<template<typename> class P>
+struct Chain_node
+{
+    P<Chain_node> next;
+    int* counter;
+
+    explicit Chain_node(int* counter) : counter(counter) {};
+    ~Chain_node()
+    {
+        ++*counter;
+    };
+};
+
+struct Graph_node
+{
+    std::vector<shared_ptr<Graph_node>> edges;
+    int* counter;
+
+    explicit Graph_node(int* counter) : counter(counter) {};
+    ~Graph_node()
+    {
+        ++*counter;
+    };
+
+    void trace(cycle_tracer& tracer) const
+    {
+        for(const shared_ptr<Graph_node>& edge : edges)
+            tracer(edge);
+    };
+};
+
 template<typename T>
 class Test_deleter
 {
@@ -57,6 +170,70 @@ public:
     };
 };
 
+//a deleter that can't be moved while armed, so no proxy can take it
+template<typename T>
+class Throwing_deleter
+{
+    const bool* armed;
+
+public:
+    explicit Throwing_deleter(const bool* armed) : armed(armed) {};
+    Throwing_deleter(const Throwing_deleter&) = default;
+    Throwing_deleter(Throwing_deleter&& d) : armed(d.armed)
+    {
+        if(*armed)
+            throw std::runtime_error("deleter moved");
+    };
+
+    void operator()(T* ptr)
+    {
+        delete ptr;
+    };
+};
+
+template<typename T>
+class Move_only_deleter
+{
+    unique_ptr<int> token;
+    int* counter;
+
+public:
+    explicit Move_only_deleter(int* counter) : token(new int(0)), counter(counter) {};
+    Move_only_deleter(Move_only_deleter&&) = default;
+
+    void operator()(T* ptr)
+    {
+        ++*counter;
+        delete ptr;
+    };
+};
+
+class Counting_resource : public std::pmr::memory_resource
+{
+public:
+    int allocations = 0, deallocations = 0;
+    bool exhausted = false;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if(exhausted)
+            throw std::bad_alloc();
+
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    };
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        ++deallocations;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    };
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    };
+};
+
 //custom deleter, unique_ptr()
 TEST(unique_ptr, test_1)
 {
@@ -183,6 +360,47 @@ TEST(unique_ptr, test_7)
     }
 }
 
+static_assert(sizeof(unique_ptr<int>) == sizeof(int*), "empty deleters take no space");
+static_assert(sizeof(unique_ptr<int[]>) == sizeof(int*), "empty deleters take no space");
+static_assert(sizeof(unique_ptr<int, Test_deleter<int>>) == sizeof(int*) + sizeof(Test_deleter<int>), "stateful deleters are stored");
+
+//unique_ptr<T[]>, operator[], make_unique<T[]>(), make_unique_for_overwrite(), no deleter call for nullptr
+TEST(unique_ptr, test_8)
+{
+    int counter = 0;
+
+    {
+        unique_ptr<Array_element[]> up(new Array_element[3]);
+        for(int i = 0; i < 3; ++i)
+            up[i].counter = &counter;
+
+        unique_ptr<Array_element[]> up1(std::move(up));
+        EXPECT_FALSE(up);
+    }
+
+    EXPECT_EQ(counter, 3);
+
+    unique_ptr<int[]> numbers = make_unique<int[]>(100);
+    EXPECT_EQ(numbers[99], 0);
+
+    unique_ptr<double[]> buffer = make_unique_for_overwrite<double[]>(100);
+    buffer[99] = 1.0;
+    unique_ptr<long> scalar = make_unique_for_overwrite<long>();
+    *scalar = 1;
+
+    shared_ptr<int[]> shared(std::move(numbers));
+    EXPECT_EQ(shared[99], 0);
+    EXPECT_FALSE(numbers);
+
+    int d_counter = 0;
+    {
+        unique_ptr<int, Test_deleter<int>> up(nullptr, Test_deleter<int>(0, &d_counter)), up1(new int, Test_deleter<int>(0, &d_counter));
+        up = std::move(up1);
+        up.reset();
+    }
+    EXPECT_EQ(d_counter, 1);
+}
+
 //shared_ptr()
 TEST(shared_ptr, test_1)
 {
@@ -194,11 +412,12 @@ TEST(shared_ptr, test_1)
                d(std::move(up)),
                e(NULL);
 
-    EXPECT_EQ(a.DEBUG_get_proxy_addr(), Proxy_dummy<int>::instance_ptr());
-    EXPECT_EQ(b.DEBUG_get_proxy_addr(), Proxy_dummy<int>::instance_ptr());
-    EXPECT_EQ(c.DEBUG_get_proxy_addr(), Proxy_dummy<int>::instance_ptr());
-    EXPECT_EQ(d.DEBUG_get_proxy_addr(), Proxy_dummy<int>::instance_ptr());
-    EXPECT_EQ(e.DEBUG_get_proxy_addr(), Proxy_dummy<int>::instance_ptr());
+    EXPECT_EQ(a.DEBUG_get_proxy_addr(), nullptr);
+    EXPECT_EQ(b.DEBUG_get_proxy_addr(), nullptr);
+    EXPECT_EQ(c.DEBUG_get_proxy_addr(), nullptr);
+    EXPECT_EQ(d.DEBUG_get_proxy_addr(), nullptr);
+    EXPECT_EQ(e.DEBUG_get_proxy_addr(), nullptr);
+    EXPECT_EQ(a.use_count(), 0u);
 }
 
 //make_shared, shared_ptr.operator=(shared_ptr&&), shared_ptr.use_count
@@ -323,157 +542,1701 @@ TEST(shared_ptr, test_6)
     }
 }
 
-//weak_ptr.lock(), weak_ptr.use_count(), weak_ptr(const shared_ptr&), shared_ptr(const shared_ptr&), weak_ptr(const weak_ptr&)
-TEST(shared_ptr_and_weak_ptr, test_1)
+//two-word handles: get() doesn't go through the proxy
+TEST(shared_ptr, test_7)
 {
-    int counter = 0;
-
-    {
-        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 2);
-        weak_ptr<Testing_class> wp(sp), wp1(wp);
-        shared_ptr<Testing_class> sp1(wp.lock());
+    EXPECT_EQ(sizeof(shared_ptr<int>), 2 * sizeof(int*));
+    EXPECT_EQ(sizeof(weak_ptr<int>), 2 * sizeof(int*));
 
-        EXPECT_EQ(sp.use_count(), 2);
-        EXPECT_EQ(wp.use_count(), 2);
-        EXPECT_EQ(sp1->get_var(), 2);
-        EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
-    }
+    shared_ptr<int> sp = make_shared<int>(3);
+    weak_ptr<int> wp(sp);
 
-    EXPECT_EQ(counter, 1);
+    EXPECT_EQ(sp.get(), wp.lock().get());
+    EXPECT_EQ(*sp, 3);
 }
 
-//weak_ptr.operator=(const shared_ptr&), weak_ptr.operator=(const weak_ptr&), weak_ptr.reset(), std::swap(weak_ptr&, weak_ptr&)
-TEST(shared_ptr_and_weak_ptr, test_2)
+//shared_ptr<Base>(shared_ptr<Derived>), aliasing constructor, weak_ptr<Base>(weak_ptr<Derived>)
+TEST(shared_ptr, test_8)
 {
     int counter = 0;
 
-    weak_ptr<Testing_class> wp;
-
     {
-        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 2), sp1 = make_shared<Testing_class>(&counter, 3);
-        weak_ptr<Testing_class> wp1, wp2, wp3(sp1);
+        shared_ptr<Derived> derived = make_shared<Derived>(&counter);
+        shared_ptr<Base> base(derived);
+        shared_ptr<int> field(derived, &derived->derived_field);
 
-        wp = sp;
-        wp1 = wp;
-        wp2 = sp;
+        EXPECT_EQ(derived.use_count(), 3);
+        EXPECT_EQ(base.DEBUG_get_proxy_addr(), derived.DEBUG_get_proxy_addr());
+        EXPECT_EQ(field.DEBUG_get_proxy_addr(), derived.DEBUG_get_proxy_addr());
+        EXPECT_EQ(base->base_field, 1);
+        EXPECT_EQ(*field, 2);
 
-        EXPECT_EQ(wp.DEBUG_weak_links_count(), 3);
-        EXPECT_EQ(sp.use_count(), 1);
+        weak_ptr<Derived> wd(derived);
+        weak_ptr<Base> wb(wd);
 
-        wp1.reset();
+        derived.reset();
+        base = shared_ptr<Derived>();
 
-        EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
-        EXPECT_EQ(wp2.DEBUG_weak_links_count(), 2);
+        EXPECT_EQ(counter, 0); //field держит объект
+        EXPECT_EQ(wb.lock()->base_field, 1);
 
-        std::swap(wp3, wp2);
+        field.reset();
 
-        EXPECT_EQ(wp3.lock()->get_var(), 2);
-        EXPECT_EQ(wp2.lock()->get_var(), 3);
+        EXPECT_EQ(counter, 1);
+        EXPECT_FALSE(wb.lock());
+        EXPECT_EQ(wb.use_count(), 0);
+
+        shared_ptr<Base> moved(std::move(shared_ptr<Derived>(new Derived(&counter))));
+
+        EXPECT_EQ(moved.use_count(), 1);
     }
 
-    EXPECT_EQ(wp.use_count(), 0);
-    EXPECT_EQ(wp.DEBUG_weak_links_count(), 1);
     EXPECT_EQ(counter, 2);
 }
 
-//shared_ptr(const weak_ptr&)
-TEST(shared_ptr_and_weak_ptr, test_3)
+//static_pointer_cast, dynamic_pointer_cast, const_pointer_cast
+TEST(shared_ptr, test_9)
 {
     int counter = 0;
 
     {
-        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 4);
-        weak_ptr<Testing_class> wp(sp);
+        shared_ptr<Base> base = make_shared<Derived>(&counter), plain = make_shared<Base>();
+        shared_ptr<Derived> derived = static_pointer_cast<Derived>(base);
 
-        EXPECT_EQ(wp.use_count(), 1);
-        EXPECT_EQ(wp.DEBUG_weak_links_count(), 1);
+        EXPECT_EQ(derived->derived_field, 2);
+        EXPECT_EQ(base.use_count(), 2);
+        EXPECT_EQ(dynamic_pointer_cast<Derived>(base), derived);
+        EXPECT_FALSE(dynamic_pointer_cast<Derived>(plain));
+        EXPECT_EQ(plain.use_count(), 1);
 
-        EXPECT_NO_THROW(shared_ptr<Testing_class> sp(wp));
+        shared_ptr<const Derived> const_derived(derived);
+        shared_ptr<Derived> mutable_derived = const_pointer_cast<Derived>(const_derived);
 
-        sp.reset();
+        mutable_derived->derived_field = 5;
 
-        EXPECT_THROW(shared_ptr<Testing_class> sp(wp), bad_weak_ptr);
+        EXPECT_EQ(derived->derived_field, 5);
+        EXPECT_EQ(base.use_count(), 4);
+    }
 
-        EXPECT_EQ(counter, 1);
+    EXPECT_EQ(counter, 1);
+}
+
+//make_shared for over-aligned types, make_shared_cache_aligned
+TEST(shared_ptr, test_10)
+{
+    for(size_t i = 0; i < 16; ++i)
+    {
+        shared_ptr<Simd_payload> simd = make_shared<Simd_payload>();
+        shared_ptr<long double> ld = make_shared<long double>(1.5);
+        shared_ptr<int> aligned = make_shared_cache_aligned<int>(7);
+
+        uintptr_t object = reinterpret_cast<uintptr_t>(aligned.get()),
+                  proxy = reinterpret_cast<uintptr_t>(aligned.DEBUG_get_proxy_addr());
+
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(simd.get()) % 64, 0u);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(ld.get()) % alignof(long double), 0u);
+        EXPECT_EQ(object % cache_line_size, 0u);
+        EXPECT_NE(object / cache_line_size, proxy / cache_line_size);
+        EXPECT_EQ(*aligned, 7);
     }
 }
 
-//проверка на то, что не крашится с тяжелым deleter
-TEST(shared_ptr_and_weak_ptr, test_4)
+//compact proxies, move-only deleters
+TEST(shared_ptr, test_11)
 {
+#if !defined(TUZ_BIASED_REFCOUNT) && !defined(TUZ_TRACK_PROXIES)
+    EXPECT_EQ(sizeof(Proxy_base), 2 * sizeof(void*));
+#endif
+    EXPECT_EQ(sizeof(Make_shared_proxy<int>), sizeof(Proxy_base) + sizeof(void*));
+    EXPECT_EQ(sizeof(Proxy_deleter<int, default_delete<int>>), sizeof(Proxy_base) + sizeof(void*));
+    EXPECT_EQ(sizeof(Proxy_deleter<int, Test_deleter<int>>), sizeof(Proxy_deleter<int, default_delete<int>>) + sizeof(Test_deleter<int>));
+
     int d_counter = 0, t_counter = 0;
 
     {
-        unique_ptr<Testing_class, Test_deleter<Testing_class>> up(new Testing_class(&t_counter, 3), Test_deleter<Testing_class>(5, &d_counter));
-        shared_ptr<Testing_class> sp(std::move(up));
-
-        EXPECT_EQ(sp->get_var(), 3);
-        EXPECT_EQ(t_counter, 0);
-        EXPECT_EQ(d_counter, 0);
+        shared_ptr<Testing_class> sp(new Testing_class(&t_counter), Move_only_deleter<Testing_class>(&d_counter));
+        shared_ptr<Testing_class> sp1 = sp;
 
-        weak_ptr<Testing_class> wp(sp);
-        sp.reset();
+        sp.reset(new Testing_class(&t_counter), Move_only_deleter<Testing_class>(&d_counter));
 
-        EXPECT_EQ(t_counter, 1);
-        EXPECT_EQ(d_counter, 1);
+        EXPECT_EQ(t_counter, 0);
     }
+
+    EXPECT_EQ(t_counter, 2);
+    EXPECT_EQ(d_counter, 2);
 }
 
-//self-assignment problem
-TEST(shared_ptr_and_weak_ptr, test_5)
+//32-bit counters saturate instead of wrapping around
+TEST(shared_ptr, test_12)
 {
-    shared_ptr<int> sp = make_shared<int>(9);
+    atomic_counter counter(max_links - 2);
 
-    EXPECT_NO_THROW(sp = sp);
+    counter.increment();
+    counter.increment();
 
-    weak_ptr<int> wp(sp);
+    EXPECT_EQ(counter.load(), saturated_links);
+    EXPECT_NE(counter.decrement(), 0u);
+    EXPECT_TRUE(counter.increment_if_not_zero());
+    EXPECT_EQ(counter.load(), saturated_links);
 
-    sp.reset();
+    single_threaded_counter plain(max_links - 1);
 
-    EXPECT_NO_THROW(wp = wp);
+    plain.increment();
+
+    EXPECT_EQ(plain.decrement(), saturated_links);
 }
 
-//Вспомогательная функция.
-void esft_test_helper(shared_ptr<Esft_test>& sp, Esft_test* esft)
+//allocate_shared(), shared_ptr(T*, D, A), reset(T*, D, A)
+TEST(shared_ptr, test_13)
 {
-    EXPECT_EQ(sp->var, esft->var);
+    Counting_resource resource;
+    std::pmr::polymorphic_allocator<int> alloc(&resource);
+    int t_counter = 0, d_counter = 0;
 
-    weak_ptr<Esft_test> wp = sp;
-    shared_ptr<Esft_test> sp1(sp);
+    {
+        shared_ptr<Testing_class> sp = allocate_shared<Testing_class>(alloc, &t_counter);
+        weak_ptr<Testing_class> wp = sp;
 
-    EXPECT_EQ(sp.use_count(), 2);
-    EXPECT_EQ(wp.DEBUG_weak_links_count(), 2); //там ещё в esft weak_ptr лежит
+        EXPECT_EQ(resource.allocations, 1);
 
-    shared_ptr<Esft_test> sp2 = esft->shared_from_this();
+        sp.reset();
 
-    EXPECT_EQ(wp.use_count(), 3);
-    EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
-    EXPECT_EQ(sp->var, sp2->var);
+        EXPECT_EQ(t_counter, 1);
+        EXPECT_EQ(resource.deallocations, 0);
+    }
+
+    EXPECT_EQ(resource.deallocations, 1);
+
+    {
+        shared_ptr<Testing_class> sp(new Testing_class(&t_counter), Test_deleter<Testing_class>(0, &d_counter), alloc);
+
+        EXPECT_EQ(resource.allocations, 2);
+
+        sp.reset(new Testing_class(&t_counter), Test_deleter<Testing_class>(0, &d_counter), alloc);
+
+        EXPECT_EQ(t_counter, 2);
+        EXPECT_EQ(resource.deallocations, 2);
+    }
+
+    EXPECT_EQ(t_counter, 3);
+    EXPECT_EQ(d_counter, 2);
+    EXPECT_EQ(resource.allocations, resource.deallocations);
+
+    //a failed reset deletes the new object and keeps the old one
+    {
+        shared_ptr<Testing_class> sp(new Testing_class(&t_counter, 1));
+
+        resource.exhausted = true;
+
+        EXPECT_THROW(sp.reset(new Testing_class(&t_counter, 2), Test_deleter<Testing_class>(0, &d_counter), alloc), std::bad_alloc);
+        EXPECT_EQ(sp.use_count(), 1u);
+        EXPECT_EQ(sp->get_var(), 1);
+        EXPECT_EQ(t_counter, 4);
+        EXPECT_EQ(d_counter, 3);
+
+        resource.exhausted = false;
+    }
+
+    EXPECT_EQ(t_counter, 5);
+
+    //pmr containers get the resource passed down by uses-allocator construction
+    std::pmr::monotonic_buffer_resource arena(&resource);
+    std::pmr::polymorphic_allocator<char> arena_alloc(&arena);
+    shared_ptr<std::pmr::vector<int>> vec = allocate_shared<std::pmr::vector<int>>(arena_alloc, 100, 1);
+
+    EXPECT_EQ(vec->get_allocator().resource(), &arena);
+    EXPECT_EQ((*vec)[99], 1);
+
+    //the allocator is stored only when it has state
+    EXPECT_EQ(sizeof(Allocate_shared_proxy<int, std::allocator<int>>), sizeof(Proxy_base) + sizeof(void*));
 }
 
-//проверка для простого конструктора
-TEST(enable_shared_from_this, test_1)
+//shared_ptr<T[]>, shared_ptr<T[N]>, operator[], make_shared<T[]>(), make_shared_for_overwrite()
+TEST(shared_ptr, test_14)
 {
-    weak_ptr<Esft_test> wp;
+    int counter = 0;
 
     {
-        Esft_test* esft = new Esft_test(5);
-        shared_ptr<Esft_test> sp(esft);
-
-        esft_test_helper(sp, sp.get());
+        shared_ptr<Array_element[]> sp(new Array_element[3]);
+        shared_ptr<Array_element[]> sp1 = sp;
 
-        wp = sp;
-        EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
+        for(int i = 0; i < 3; ++i)
+            sp1[i].counter = &counter;
     }
 
-    EXPECT_EQ(wp.DEBUG_weak_links_count(), 1); //объект удалился, значит и weak_ptr в нем тоже
+    EXPECT_EQ(counter, 3);
+
+    shared_ptr<int[]> numbers = make_shared<int[]>(1000);
+    EXPECT_EQ(numbers[0], 0);
+    EXPECT_EQ(numbers[999], 0);
+
+    shared_ptr<int[4]> fours = make_shared<int[4]>(4);
+    EXPECT_EQ(fours[3], 4);
+
+    shared_ptr<double[][2]> pairs = make_shared<double[][2]>(3, {1.0, 2.0});
+    EXPECT_EQ(pairs[2][0], 1.0);
+    EXPECT_EQ(pairs[2][1], 2.0);
+
+    shared_ptr<Simd_payload[]> lanes = make_shared_for_overwrite<Simd_payload[]>(5);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&lanes[1]) % alignof(Simd_payload), 0u);
+
+    shared_ptr<float[64]> buffer = make_shared_for_overwrite<float[64]>();
+    buffer[63] = 1.0f;
+
+    //the elements follow the proxy, the control block and the array are one allocation
+    EXPECT_EQ(reinterpret_cast<const unsigned char*>(numbers.get()) - reinterpret_cast<const unsigned char*>(numbers.DEBUG_get_proxy_addr()), long(sizeof(Make_shared_array_proxy<int>)));
+
+    counter = 0;
+    {
+        shared_ptr<Array_element[]> elements = make_shared<Array_element[]>(4, Array_element{&counter});
+        counter = 0;
+    }
+    EXPECT_EQ(counter, 4);
 }
 
-//проверка для make_shared
-TEST(enable_shared_from_this, test_2)
+//moves don't touch the counters, relocate(), relocating_vector
+TEST(shared_ptr, test_15)
 {
-    shared_ptr<Esft_test> sp = make_shared<Esft_test>(5);
-    esft_test_helper(sp, sp.get());
+    int counter = 0;
+    shared_ptr<Testing_class> sp(new Testing_class(&counter));
+    weak_ptr<Testing_class> wp(sp);
+
+    shared_ptr<Testing_class> moved(std::move(sp));
+    EXPECT_EQ(sp.DEBUG_get_proxy_addr(), nullptr);
+    EXPECT_EQ(moved.use_count(), 1);
+
+    sp = std::move(moved);
+    EXPECT_EQ(moved.DEBUG_get_proxy_addr(), nullptr);
+    EXPECT_EQ(sp.use_count(), 1);
+
+    weak_ptr<Testing_class> wp1(std::move(wp));
+    EXPECT_EQ(wp.DEBUG_get_proxy_addr(), nullptr);
+    EXPECT_EQ(wp1.DEBUG_weak_links_count(), 1u);
+
+    static_assert(is_trivially_relocatable<shared_ptr<int>>::value, "");
+    static_assert(is_trivially_relocatable<weak_ptr<int>>::value, "");
+    static_assert(is_trivially_relocatable<unique_ptr<int>>::value, "");
+    static_assert(!is_trivially_relocatable<std::vector<int>>::value, "");
+
+    {
+        relocating_vector<shared_ptr<Testing_class>> v;
+
+        for(int i = 0; i < 1000; ++i)
+            v.push_back(sp);
+        v.emplace_back(v[0]);
+
+        EXPECT_EQ(sp.use_count(), 1002);
+        EXPECT_EQ(v.size(), 1001u);
+        EXPECT_EQ(v[1000].get(), sp.get());
+
+        relocating_vector<std::vector<int>> vectors;
+        for(int i = 0; i < 100; ++i)
+            vectors.emplace_back(3, i);
+        EXPECT_EQ(vectors[99][2], 99);
+    }
+
+    EXPECT_EQ(sp.use_count(), 1);
+    sp.reset();
+    EXPECT_EQ(counter, 1);
+}
+
+//local_shared_ptr: make_local_shared, copies, reset, use_count
+//shared_ptr = unique_ptr&& that fails keeps both sides as they were
+TEST(shared_ptr, test_16)
+{
+    int counter = 0;
+    bool armed = false;
+
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 1);
+        unique_ptr<Testing_class, Throwing_deleter<Testing_class>> up(new Testing_class(&counter, 2), Throwing_deleter<Testing_class>(&armed));
+
+        armed = true;
+
+        EXPECT_THROW(sp = std::move(up), std::runtime_error);
+        EXPECT_EQ(sp.use_count(), 1u);
+        EXPECT_EQ(sp->get_var(), 1);
+        EXPECT_TRUE(up);
+        EXPECT_EQ(counter, 0);
+
+        armed = false;
+        sp = std::move(up);
+
+        EXPECT_FALSE(up);
+        EXPECT_EQ(sp->get_var(), 2);
+        EXPECT_EQ(counter, 1);
+    }
+
+    EXPECT_EQ(counter, 2);
+}
+
+TEST(local_shared_ptr, test_1)
+{
+    int counter = 0;
+
+    {
+        local_shared_ptr<Testing_class> lsp = make_local_shared<Testing_class>(&counter, 5);
+        local_shared_ptr<Testing_class> lsp1 = lsp, lsp2;
+
+        lsp2 = lsp1;
+        EXPECT_EQ(lsp.use_count(), 3u);
+        EXPECT_EQ(lsp2->get_var(), 5);
+
+        lsp1 = std::move(lsp2);
+        EXPECT_EQ(lsp.use_count(), 2u);
+        EXPECT_FALSE(lsp2);
+
+        lsp.reset(new Testing_class(&counter));
+        EXPECT_EQ(lsp1.use_count(), 1u);
+        EXPECT_EQ(counter, 0);
+
+        lsp1.reset();
+        EXPECT_EQ(counter, 1);
+
+        local_shared_ptr<int[]> numbers(new int[10]());
+        EXPECT_EQ(numbers[9], 0);
+    }
+
+    EXPECT_EQ(counter, 2);
+    EXPECT_EQ(sizeof(local_shared_ptr<int>), sizeof(shared_ptr<int>) + sizeof(std::thread::id));
+}
+
+//local_shared_ptr.promote()
+TEST(local_shared_ptr, test_2)
+{
+    int counter = 0;
+    local_shared_ptr<Testing_class> lsp = make_local_shared<Testing_class>(&counter);
+    local_shared_ptr<Testing_class> lsp1 = lsp;
+
+    EXPECT_THROW(std::move(lsp).promote(), bad_local_promotion);
+
+    lsp.reset();
+    shared_ptr<Testing_class> sp = std::move(lsp1).promote();
+
+    EXPECT_FALSE(lsp1);
+    EXPECT_EQ(sp.use_count(), 1);
+
+    std::thread([sp]
+    {
+        EXPECT_EQ(sp->get_var(), 228);
+    }).join();
+
+    sp.reset();
+    EXPECT_EQ(counter, 1);
+
+    local_shared_ptr<Esft_test> esft = make_local_shared<Esft_test>(1);
+    shared_ptr<Esft_test> promoted = std::move(esft).promote();
+
+    EXPECT_EQ(promoted->shared_from_this(), promoted);
+}
+
+//make_intrusive, intrusive_ptr(T*, bool), copies, moves, reset, detach, intrusive_from_this, use_count
+TEST(intrusive_ptr, test_1)
+{
+    static_assert(sizeof(intrusive_ptr<Intrusive_test<default_counter>>) == sizeof(void*), "a handle is one pointer");
+
+    int counter = 0;
+
+    {
+        intrusive_ptr<Intrusive_test<single_threaded_counter>> ip = make_intrusive<Intrusive_test<single_threaded_counter>>(&counter);
+        intrusive_ptr<Intrusive_test<single_threaded_counter>> ip1 = ip;
+
+        EXPECT_EQ(ip->use_count(), 2u);
+        EXPECT_EQ(ip1->var, 228);
+        EXPECT_EQ(ip, ip1);
+
+        intrusive_ptr<Intrusive_test<single_threaded_counter>> ip2 = std::move(ip1);
+
+        EXPECT_FALSE(ip1);
+        EXPECT_EQ(ip->use_count(), 2u);
+        EXPECT_EQ(ip2->intrusive_from_this(), ip);
+        EXPECT_EQ(ip->use_count(), 2u);
+
+        Intrusive_test<single_threaded_counter>* raw = ip2.detach();
+
+        EXPECT_FALSE(ip2);
+        EXPECT_EQ(ip->use_count(), 2u);
+        ip2.reset(raw, false);
+        EXPECT_EQ(ip->use_count(), 2u);
+
+        ip.reset();
+        ip2.reset();
+        EXPECT_EQ(counter, 1);
+    }
+
+    {
+        intrusive_ptr<Intrusive_test<default_counter>> base(new Intrusive_derived(&counter));
+        intrusive_ptr<Intrusive_derived> derived = make_intrusive<Intrusive_derived>(&counter);
+
+        base = derived;
+        EXPECT_EQ(counter, 2);
+        EXPECT_EQ(base->var, 1);
+        EXPECT_EQ(derived->use_count(), 2u);
+
+        intrusive_ptr<const Intrusive_test<default_counter>> constant = std::move(base);
+
+        EXPECT_FALSE(base);
+        EXPECT_EQ(constant->intrusive_from_this()->use_count(), 3u);
+    }
+
+    EXPECT_EQ(counter, 3);
+}
+
+//to_shared(), copies from several threads
+TEST(intrusive_ptr, test_2)
+{
+    int counter = 0;
+
+    {
+        intrusive_ptr<Intrusive_test<default_counter>> ip = make_intrusive<Intrusive_test<default_counter>>(&counter, 5);
+        shared_ptr<Intrusive_test<default_counter>> sp = to_shared(ip);
+
+        EXPECT_EQ(sp.get(), ip.get());
+        EXPECT_EQ(ip->use_count(), 2u);
+
+        ip.reset();
+        EXPECT_EQ(counter, 0);
+        EXPECT_EQ(sp->var, 5);
+
+        ip = sp->intrusive_from_this();
+        sp.reset();
+        EXPECT_EQ(ip->use_count(), 1u);
+        EXPECT_FALSE(to_shared(intrusive_ptr<Intrusive_test<default_counter>>()));
+
+        std::vector<std::thread> threads;
+
+        for(size_t i = 0; i < 4; ++i)
+            threads.emplace_back([&ip]()
+            {
+                for(size_t j = 0; j < 100000; ++j)
+                {
+                    intrusive_ptr<Intrusive_test<default_counter>> copy(ip);
+                    copy.reset();
+                }
+            });
+
+        for(std::thread& t : threads)
+            t.join();
+
+        EXPECT_EQ(ip->use_count(), 1u);
+        EXPECT_EQ(counter, 0);
+    }
+
+    EXPECT_EQ(counter, 1);
+}
+
+//Block_pool: reuse, size classes, frees from another thread
+TEST(pool, test_1)
+{
+    void* p = Block_pool::allocate_block(24);
+    Block_pool::deallocate_block(p);
+    pool_stats before = get_pool_stats();
+    void* q = Block_pool::allocate_block(32);
+
+    EXPECT_EQ(p, q);
+    EXPECT_EQ(get_pool_stats().hits, before.hits + 1);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(q) % alignof(std::max_align_t), 0u);
+
+    void* big = Block_pool::allocate_block(Block_pool::max_block_size + 1);
+    Block_pool::deallocate_block(big);
+
+    std::vector<void*> blocks;
+    for(int i = 0; i < 100; ++i)
+        blocks.push_back(Block_pool::allocate_block(48));
+
+    //frees from the other thread come back in batches and are reused here
+    std::thread([&blocks]
+    {
+        for(void* block : blocks)
+            Block_pool::deallocate_block(block);
+    }).join();
+
+    pool_stats middle = get_pool_stats();
+
+    for(void*& block : blocks)
+        block = Block_pool::allocate_block(48);
+
+    pool_stats after = get_pool_stats();
+
+    EXPECT_EQ(after.remote_frees, middle.remote_frees + 100);
+    EXPECT_EQ(after.hits, middle.hits + 100);
+    EXPECT_EQ(after.misses, middle.misses);
+
+    for(void* block : blocks)
+        Block_pool::deallocate_block(block);
+    Block_pool::deallocate_block(q);
+
+    EXPECT_GT(get_pool_stats().retained_bytes, 0u);
+}
+
+//make_shared_deferred, deferred_delete, flush_deferred, get_deferred_stats, inline reclaims of a full queue
+TEST(deferred, test_1)
+{
+    int counter = 0;
+    flush_deferred();
+    deferred_stats before = get_deferred_stats();
+
+    shared_ptr<Testing_class> sp = make_shared_deferred<Testing_class>(&counter, 5);
+    weak_ptr<Testing_class> wp(sp);
+
+    EXPECT_EQ(sp->get_var(), 5);
+
+    sp.reset();
+    EXPECT_EQ(counter, 0);
+    EXPECT_EQ(wp.use_count(), 0u);
+    EXPECT_FALSE(wp.lock());
+    EXPECT_EQ(get_deferred_stats().queued, before.queued + 1);
+    EXPECT_EQ(get_deferred_stats().queued_bytes, before.queued_bytes + sizeof(Testing_class));
+
+    EXPECT_EQ(flush_deferred(), 1u);
+    EXPECT_EQ(counter, 1);
+    EXPECT_EQ(get_deferred_stats().queued, 0u);
+    EXPECT_EQ(get_deferred_stats().reclaimed, before.reclaimed + 1);
+
+    //the proxy outlives the queue entry while a weak_ptr is left
+    wp.reset();
+
+    {
+        shared_ptr<Testing_class> sp_d(new Testing_class(&counter), deferred_delete<Testing_class>());
+        unique_ptr<Testing_class, deferred_delete<Testing_class>> up(new Testing_class(&counter));
+    }
+
+    EXPECT_EQ(counter, 1);
+    EXPECT_EQ(flush_deferred(), 2u);
+    EXPECT_EQ(counter, 3);
+
+    std::vector<shared_ptr<Testing_class>> many;
+    for(int i = 0; i < 5000; ++i)
+        many.push_back(make_shared_deferred<Testing_class>(&counter));
+
+    many.clear();
+
+    deferred_stats full = get_deferred_stats();
+    EXPECT_EQ(full.queued + full.inline_reclaims - before.inline_reclaims, 5000u);
+    EXPECT_GT(full.inline_reclaims, before.inline_reclaims);
+
+    flush_deferred();
+    EXPECT_EQ(counter, 5003);
+}
+
+//the background reclaimer takes objects released on several threads, stop_deferred_reclaimer() drains the queue
+TEST(deferred, test_2)
+{
+    int counter = 0;
+    std::vector<shared_ptr<Testing_class>> objects;
+
+    for(int i = 0; i < 1000; ++i)
+        objects.push_back(make_shared_deferred<Testing_class>(&counter));
+
+    start_deferred_reclaimer();
+
+    std::vector<std::thread> threads;
+
+    for(size_t i = 0; i < 4; ++i)
+        threads.emplace_back([&objects, i]()
+        {
+            for(size_t j = i; j < objects.size(); j += 4)
+            {
+                shared_ptr<Testing_class> copy(objects[j]);
+                copy.reset();
+            }
+        });
+
+    for(std::thread& t : threads)
+        t.join();
+
+    for(size_t i = 0; i < 4; ++i)
+        threads[i] = std::thread([&objects, i]()
+        {
+            for(size_t j = i; j < objects.size(); j += 4)
+                objects[j].reset();
+        });
+
+    for(std::thread& t : threads)
+        t.join();
+
+#ifdef TUZ_BIASED_REFCOUNT
+    //the last links were dropped on other threads and wait for this one
+    drain_biased_queue();
+#endif
+
+    stop_deferred_reclaimer();
+
+    EXPECT_EQ(counter, 1000);
+    EXPECT_EQ(get_deferred_stats().queued, 0u);
+    EXPECT_EQ(get_deferred_stats().queued_bytes, 0u);
+}
+
+struct Deferred_buffer
+{
+    int* counter;
+    std::vector<char> bytes;
+
+    Deferred_buffer(int* counter, size_t size) : counter(counter), bytes(size) {};
+    ~Deferred_buffer()
+    {
+        ++*counter;
+    };
+};
+
+namespace tuz
+{
+
+template<>
+struct deferred_size<Deferred_buffer>
+{
+    static size_t of(const Deferred_buffer& buffer) noexcept
+    {
+        return sizeof(buffer) + buffer.bytes.capacity();
+    };
+};
+
+}
+
+//deferred_size: queued_bytes counts what an object owns besides its own bytes
+TEST(deferred, test_3)
+{
+    int counter = 0;
+    flush_deferred();
+    deferred_stats before = get_deferred_stats();
+
+    {
+        shared_ptr<Deferred_buffer> sp = make_shared_deferred<Deferred_buffer>(&counter, 1000);
+        shared_ptr<Deferred_buffer> sp_d(new Deferred_buffer(&counter, 200), deferred_delete<Deferred_buffer>());
+    }
+
+    EXPECT_EQ(counter, 0);
+    EXPECT_EQ(get_deferred_stats().queued, before.queued + 2);
+    EXPECT_EQ(get_deferred_stats().queued_bytes, before.queued_bytes + 2 * sizeof(Deferred_buffer) + 1200);
+
+    EXPECT_EQ(flush_deferred(), 2u);
+    EXPECT_EQ(counter, 2);
+    EXPECT_EQ(get_deferred_stats().queued_bytes, 0u);
+}
+
+//chains far deeper than the stack would allow: shared_ptr with weak_ptrs into the chain, local_shared_ptr
+TEST(teardown, test_1)
+{
+    const int length = 1000000;
+    int counter = 0;
+    weak_ptr<Chain_node<shared_ptr>> middle, last;
+
+    {
+        shared_ptr<Chain_node<shared_ptr>> head = make_shared<Chain_node<shared_ptr>>(&counter);
+        Chain_node<shared_ptr>* tail = head.get();
+
+        for(int i = 1; i < length; ++i)
+        {
+            tail->next = i % 2 ? make_shared<Chain_node<shared_ptr>>(&counter) : shared_ptr<Chain_node<shared_ptr>>(new Chain_node<shared_ptr>(&counter));
+
+            if(i == length / 2)
+                middle = tail->next;
+
+            tail = tail->next.get();
+        }
+
+        last = tail->next = make_shared<Chain_node<shared_ptr>>(&counter);
+        EXPECT_EQ(counter, 0);
+    }
+
+    EXPECT_EQ(counter, length + 1);
+    EXPECT_FALSE(middle.lock());
+    EXPECT_FALSE(last.lock());
+
+    counter = 0;
+
+    {
+        local_shared_ptr<Chain_node<local_shared_ptr>> head = make_local_shared<Chain_node<local_shared_ptr>>(&counter);
+
+        for(int i = 1; i < length; ++i)
+        {
+            local_shared_ptr<Chain_node<local_shared_ptr>> node = make_local_shared<Chain_node<local_shared_ptr>>(&counter);
+            node->next = std::move(head);
+            head = std::move(node);
+        }
+    }
+
+    EXPECT_EQ(counter, length);
+}
+
+//make_shared_collectable, collect_cycles, get_cycle_stats: rings, self-links, rings held from outside, tails out of a ring
+TEST(cycles, test_1)
+{
+    int counter = 0;
+    collect_cycles();
+    cycle_stats before = get_cycle_stats();
+    weak_ptr<Graph_node> watcher;
+
+    {
+        shared_ptr<Graph_node> a = make_shared_collectable<Graph_node>(&counter);
+        shared_ptr<Graph_node> b = make_shared_collectable<Graph_node>(&counter);
+        shared_ptr<Graph_node> self = make_shared_collectable<Graph_node>(&counter);
+
+        a->edges.push_back(b);
+        b->edges.push_back(a);
+        self->edges.push_back(self);
+        watcher = a;
+    }
+
+    EXPECT_EQ(counter, 0);
+    EXPECT_EQ(watcher.use_count(), 1u);
+
+    collect_cycles();
+
+    EXPECT_EQ(counter, 3);
+    EXPECT_FALSE(watcher.lock());
+    EXPECT_EQ(get_cycle_stats().reclaimed_objects, before.reclaimed_objects + 3);
+    EXPECT_GT(get_cycle_stats().last_reclaimed_bytes, 3 * sizeof(Graph_node));
+
+    counter = 0;
+
+    {
+        shared_ptr<Graph_node> outside = make_shared_collectable<Graph_node>(&counter);
+        shared_ptr<Graph_node> ring = make_shared_collectable<Graph_node>(&counter);
+        shared_ptr<Graph_node> plain(new Graph_node(&counter));
+
+        ring->edges.push_back(make_shared_collectable<Graph_node>(&counter));
+        ring->edges[0]->edges.push_back(ring);
+        ring->edges[0]->edges.push_back(plain);
+        outside->edges.push_back(ring);
+
+        ring.reset();
+        collect_cycles();
+        EXPECT_EQ(counter, 0);
+
+        plain.reset();
+        outside->edges.clear();
+    }
+
+    //the ring, the node outside it and the plain node it held
+    EXPECT_EQ(counter, 1);
+    collect_cycles();
+    EXPECT_EQ(counter, 4);
+}
+
+//collection in slices of a few visits, a list hanging off a ring, shared_ptr edges to objects without a trace
+TEST(cycles, test_2)
+{
+    int counter = 0;
+    collect_cycles();
+
+    for(int i = 0; i < 10; ++i)
+    {
+        shared_ptr<Graph_node> first = make_shared_collectable<Graph_node>(&counter);
+        shared_ptr<Graph_node> second = make_shared_collectable<Graph_node>(&counter);
+
+        first->edges.push_back(second);
+        second->edges.push_back(first);
+    }
+
+    EXPECT_EQ(collect_cycles(2), 0u);
+    EXPECT_EQ(counter, 0);
+    EXPECT_GT(get_cycle_stats().pending_roots, 0u);
+
+    size_t bytes = 0;
+
+    while(get_cycle_stats().pending_roots)
+        bytes += collect_cycles(2);
+
+    EXPECT_GT(bytes, 0u);
+    EXPECT_EQ(counter, 20);
+
+    counter = 0;
+
+    {
+        shared_ptr<Graph_node> ring = make_shared_collectable<Graph_node>(&counter);
+        ring->edges.push_back(ring);
+
+        Graph_node* tail = ring.get();
+        for(int i = 0; i < 100000; ++i)
+        {
+            tail->edges.push_back(make_shared_collectable<Graph_node>(&counter));
+            tail = tail->edges.back().get();
+        }
+    }
+
+    collect_cycles();
+    EXPECT_EQ(counter, 100001);
+    EXPECT_EQ(get_cycle_stats().pending_roots, 0u);
+}
+
+//one root that reaches a large graph is collected over many calls
+TEST(cycles, test_3)
+{
+    int counter = 0;
+    collect_cycles();
+
+    {
+        shared_ptr<Graph_node> head = make_shared_collectable<Graph_node>(&counter);
+        Graph_node* tail = head.get();
+
+        for(int i = 1; i < 10000; ++i)
+        {
+            tail->edges.push_back(make_shared_collectable<Graph_node>(&counter));
+            tail = tail->edges.back().get();
+        }
+
+        tail->edges.push_back(head);
+        collect_cycles();
+    }
+
+    EXPECT_EQ(get_cycle_stats().pending_roots, 1u);
+
+    collect_cycles(100);
+    EXPECT_EQ(counter, 0);
+
+    size_t calls = 1;
+
+    for(; get_cycle_stats().pending_roots; ++calls)
+        collect_cycles(100);
+
+    EXPECT_EQ(counter, 10000);
+    //marking, scanning and collecting each visit every node
+    EXPECT_GT(calls, 300u);
+}
+
+//a link taken to the garbage between calls keeps it alive
+TEST(cycles, test_4)
+{
+    int counter = 0;
+    collect_cycles();
+
+    shared_ptr<Graph_node> keep, start = make_shared_collectable<Graph_node>(&counter);
+    Graph_node* tail = start.get();
+
+    for(int i = 1; i < 10; ++i)
+    {
+        tail->edges.push_back(make_shared_collectable<Graph_node>(&counter));
+        tail = tail->edges.back().get();
+    }
+
+    tail->edges.push_back(start);
+    keep = start->edges[0]->edges[0]->edges[0]->edges[0]->edges[0];
+    collect_cycles();
+
+    start.reset();
+    //the first nodes of the ring are counted with the link of keep elsewhere
+    collect_cycles(3);
+
+    shared_ptr<Graph_node> node = keep;
+
+    for(int i = 0; i < 7; ++i)
+        node = node->edges[0];
+
+    keep = node;
+    node.reset();
+
+    while(get_cycle_stats().pending_roots)
+        collect_cycles(3);
+
+    EXPECT_EQ(counter, 0);
+    EXPECT_EQ(keep->edges.size(), 1u);
+
+    keep.reset();
+
+    while(get_cycle_stats().pending_roots)
+        collect_cycles(3);
+
+    EXPECT_EQ(counter, 10);
+}
+
+struct Instrumented
+{
+    int value;
+
+    explicit Instrumented(int value) : value(value) {};
+};
+
+static instrument_counts counts_of_instrumented()
+{
+    for(const instrument_counts& counts : instrument_snapshot())
+        if(counts.type.find("Instrumented") != std::string::npos)
+            return counts;
+
+    return instrument_counts{};
+}
+
+//instrument_snapshot: allocations, links, failed locks and live objects of one type
+TEST(instrument, test_1)
+{
+#ifdef TUZ_INSTRUMENT
+    {
+        shared_ptr<Instrumented> a = make_shared<Instrumented>(1);
+        shared_ptr<Instrumented> b(new Instrumented(2));
+        shared_ptr<Instrumented> c(a);
+        weak_ptr<Instrumented> wb(b);
+
+        instrument_counts counts = counts_of_instrumented();
+
+        EXPECT_EQ(counts.make_shared_allocations, 1u);
+        EXPECT_EQ(counts.separate_allocations, 1u);
+        EXPECT_EQ(counts.live_objects, 2u);
+        EXPECT_EQ(counts.peak_live_objects, 2u);
+        EXPECT_EQ(counts.weak_check_ins, 1u);
+
+        b.reset();
+        EXPECT_FALSE(wb.lock());
+        EXPECT_TRUE(weak_ptr<Instrumented>(a).lock());
+    }
+
+    instrument_counts counts = counts_of_instrumented();
+
+    EXPECT_NE(counts.type.find("Instrumented"), std::string::npos);
+    EXPECT_EQ(counts.proxies_created, 2u);
+    EXPECT_EQ(counts.proxies_destroyed, 2u);
+    EXPECT_EQ(counts.failed_locks, 1u);
+    EXPECT_EQ(counts.shared_check_ins, counts.shared_check_outs);
+    EXPECT_EQ(counts.weak_check_ins, counts.weak_check_outs);
+    EXPECT_EQ(counts.live_objects, 0u);
+    EXPECT_EQ(counts.peak_live_objects, 2u);
+#else
+    shared_ptr<Instrumented> a = make_shared<Instrumented>(1);
+
+    EXPECT_TRUE(instrument_snapshot().empty());
+    EXPECT_TRUE(counts_of_instrumented().type.empty());
+#endif
+}
+
+struct Tracked
+{
+    int value;
+
+    explicit Tracked(int value) : value(value) {};
+};
+
+static shared_ptr<Tracked> make_tracked(int value)
+{
+    return make_shared<Tracked>(value);
+}
+
+static std::vector<tracked_site> sites_of_tracked()
+{
+    std::vector<tracked_site> sites;
+
+    for(const tracked_site& site : tracked_proxies())
+        if(site.type.find("Tracked") != std::string::npos)
+            sites.push_back(site);
+
+    return sites;
+}
+
+//tracked_proxies, dump_tracked_proxies: live proxies grouped by type and site, their links
+TEST(track, test_1)
+{
+    set_track_sample_period(1);
+
+    {
+        std::vector<shared_ptr<Tracked>> made;
+
+        for(int i = 0; i < 3; ++i)
+            made.push_back(make_tracked(i));
+
+        shared_ptr<Tracked> copy(made[0]);
+        weak_ptr<Tracked> watcher(made[1]);
+        shared_ptr<Tracked> separate(new Tracked(3));
+
+        std::vector<tracked_site> sites = sites_of_tracked();
+
+#ifdef TUZ_TRACK_PROXIES
+        size_t blocks = 0, shared_links = 0, weak_links = 0;
+
+        for(const tracked_site& site : sites)
+        {
+            EXPECT_FALSE(site.blocks.empty());
+
+            for(const tracked_block& block : site.blocks)
+            {
+                ++blocks;
+                shared_links += block.shared_links;
+                weak_links += block.weak_links;
+                EXPECT_GE(block.age, 0.0);
+            }
+        }
+
+        EXPECT_EQ(blocks, 4u);
+        EXPECT_EQ(shared_links, 5u);
+        EXPECT_EQ(weak_links, 1u);
+        //the three from make_tracked share a site, the separate one doesn't
+        EXPECT_GE(sites.size(), 2u);
+        EXPECT_TRUE(std::any_of(sites.begin(), sites.end(), [](const tracked_site& site)
+        {
+            return site.blocks.size() == 3;
+        }));
+
+        std::FILE* out = std::tmpfile();
+        dump_tracked_proxies(out);
+        EXPECT_GT(std::ftell(out), 0);
+        std::fclose(out);
+#else
+        EXPECT_TRUE(sites.empty());
+#endif
+    }
+
+    EXPECT_TRUE(sites_of_tracked().empty());
+
+    set_track_sample_period(0);
+
+    {
+        shared_ptr<Tracked> unsampled = make_tracked(4);
+        std::vector<tracked_site> sites = sites_of_tracked();
+
+#ifdef TUZ_TRACK_PROXIES
+        ASSERT_EQ(sites.size(), 1u);
+        EXPECT_TRUE(sites[0].backtrace.empty());
+        EXPECT_EQ(sites[0].blocks.size(), 1u);
+#else
+        EXPECT_TRUE(sites.empty());
+#endif
+    }
+
+    set_track_sample_period(TUZ_TRACK_SAMPLE);
+}
+
+struct Profiled
+{
+    int value;
+};
+
+static int by_value(shared_ptr<Profiled> sp)
+{
+    return sp->value;
+}
+
+static link_profile_site profile_of_profiled()
+{
+    link_profile_site total{std::string(), std::vector<std::string>(), 0, 0};
+
+    for(const link_profile_site& site : link_profile())
+        if(site.handle.find("Profiled") != std::string::npos)
+        {
+            total.handle = site.handle;
+            total.check_ins += site.check_ins;
+            total.check_outs += site.check_outs;
+        }
+
+    return total;
+}
+
+//set_link_profile_period, reset_link_profile, link_profile, write_link_profile, links from weak_ptr
+TEST(profile, test_1)
+{
+    shared_ptr<Profiled> sp = make_shared<Profiled>();
+    int sum = 0;
+
+    //until its next sample the thread keeps the old period
+    set_link_profile_period(1);
+    for(int i = 0; i < 2 * TUZ_PROFILE_SAMPLE; ++i)
+        sum += by_value(sp);
+
+    reset_link_profile();
+
+    for(int i = 0; i < 1000; ++i)
+        sum += by_value(sp);
+
+    EXPECT_EQ(sum, 0);
+
+    link_profile_site total = profile_of_profiled();
+
+#ifdef TUZ_PROFILE_LINKS
+    EXPECT_NE(total.handle.find("shared_ptr<Profiled>"), std::string::npos);
+    EXPECT_EQ(total.check_ins, 1000u);
+    EXPECT_EQ(total.check_outs, 1000u);
+
+    std::FILE* out = std::tmpfile();
+    write_link_profile(out);
+    EXPECT_GT(std::ftell(out), 0);
+    std::fclose(out);
+
+    //links taken through weak_ptrs are profiled like copies
+    weak_ptr<Profiled> wp = sp;
+
+    reset_link_profile();
+    EXPECT_EQ(profile_of_profiled().check_ins, 0u);
+
+    for(int i = 0; i < 500; ++i)
+    {
+        sum += wp.lock()->value;
+        sum += shared_ptr<Profiled>(wp)->value;
+    }
+
+    total = profile_of_profiled();
+
+    EXPECT_EQ(total.check_ins, 1000u);
+    EXPECT_EQ(total.check_outs, 1000u);
+
+    reset_link_profile();
+#else
+    EXPECT_EQ(total.check_ins, 0u);
+    EXPECT_TRUE(link_profile().empty());
+#endif
+
+    set_link_profile_period(TUZ_PROFILE_SAMPLE);
+}
+
+struct Slow_destructor
+{
+    char payload[100];
+
+    ~Slow_destructor()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+};
+
+static std::vector<destructor_histogram> histograms_of_slow_destructor()
+{
+    std::vector<destructor_histogram> found;
+
+    for(const destructor_histogram& h : destructor_histograms())
+        if(h.type.find("Slow_destructor") != std::string::npos)
+            found.push_back(h);
+
+    return found;
+}
+
+//destructor_histograms, reset_destructor_histograms, destructor_histogram.ns_percentile
+TEST(timing, test_1)
+{
+    {
+        shared_ptr<Slow_destructor> a = make_shared<Slow_destructor>();
+        shared_ptr<Slow_destructor> b = make_shared<Slow_destructor>();
+        shared_ptr<Slow_destructor> c(new Slow_destructor);
+        shared_ptr<Slow_destructor> copy(a);
+
+        a.reset();
+        EXPECT_TRUE(histograms_of_slow_destructor().empty());
+    }
+
+    std::vector<destructor_histogram> found = histograms_of_slow_destructor();
+
+#ifdef TUZ_TIME_DESTRUCTORS
+    ASSERT_EQ(found.size(), 1u);
+
+    const destructor_histogram& h = found[0];
+    size_t sizes = 0;
+
+    for(size_t count : h.bytes)
+        sizes += count;
+
+    EXPECT_EQ(h.count, 3u);
+    EXPECT_EQ(sizes, 3u);
+    EXPECT_EQ(h.total_bytes, 3 * sizeof(Slow_destructor));
+    EXPECT_GE(h.max_ns, 1000000u);
+    EXPECT_GE(h.total_ns, 3000000u);
+    EXPECT_GE(h.ns_percentile(0.5), 1000000u);
+    EXPECT_GE(h.ns_percentile(1), h.max_ns);
+
+    reset_destructor_histograms();
+    EXPECT_TRUE(histograms_of_slow_destructor().empty());
+#else
+    EXPECT_TRUE(found.empty());
+    EXPECT_TRUE(destructor_histograms().empty());
+#endif
+}
+
+//weak_ptr.lock(), weak_ptr.use_count(), weak_ptr(const shared_ptr&), shared_ptr(const shared_ptr&), weak_ptr(const weak_ptr&)
+TEST(shared_ptr_and_weak_ptr, test_1)
+{
+    int counter = 0;
+
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 2);
+        weak_ptr<Testing_class> wp(sp), wp1(wp);
+        shared_ptr<Testing_class> sp1(wp.lock());
+
+        EXPECT_EQ(sp.use_count(), 2);
+        EXPECT_EQ(wp.use_count(), 2);
+        EXPECT_EQ(sp1->get_var(), 2);
+        EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
+    }
+
+    EXPECT_EQ(counter, 1);
+}
+
+//weak_ptr.operator=(const shared_ptr&), weak_ptr.operator=(const weak_ptr&), weak_ptr.reset(), std::swap(weak_ptr&, weak_ptr&)
+TEST(shared_ptr_and_weak_ptr, test_2)
+{
+    int counter = 0;
+
+    weak_ptr<Testing_class> wp;
+
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 2), sp1 = make_shared<Testing_class>(&counter, 3);
+        weak_ptr<Testing_class> wp1, wp2, wp3(sp1);
+
+        wp = sp;
+        wp1 = wp;
+        wp2 = sp;
+
+        EXPECT_EQ(wp.DEBUG_weak_links_count(), 3);
+        EXPECT_EQ(sp.use_count(), 1);
+
+        wp1.reset();
+
+        EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
+        EXPECT_EQ(wp2.DEBUG_weak_links_count(), 2);
+
+        std::swap(wp3, wp2);
+
+        EXPECT_EQ(wp3.lock()->get_var(), 2);
+        EXPECT_EQ(wp2.lock()->get_var(), 3);
+    }
+
+    EXPECT_EQ(wp.use_count(), 0);
+    EXPECT_EQ(wp.DEBUG_weak_links_count(), 1);
+    EXPECT_EQ(counter, 2);
+}
+
+//shared_ptr(const weak_ptr&)
+TEST(shared_ptr_and_weak_ptr, test_3)
+{
+    int counter = 0;
+
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 4);
+        weak_ptr<Testing_class> wp(sp);
+
+        EXPECT_EQ(wp.use_count(), 1);
+        EXPECT_EQ(wp.DEBUG_weak_links_count(), 1);
+
+        EXPECT_NO_THROW(shared_ptr<Testing_class> sp(wp));
+
+        sp.reset();
+
+        EXPECT_THROW(shared_ptr<Testing_class> sp(wp), bad_weak_ptr);
+
+        EXPECT_EQ(counter, 1);
+    }
+}
+
+//проверка на то, что не крашится с тяжелым deleter
+TEST(shared_ptr_and_weak_ptr, test_4)
+{
+    int d_counter = 0, t_counter = 0;
+
+    {
+        unique_ptr<Testing_class, Test_deleter<Testing_class>> up(new Testing_class(&t_counter, 3), Test_deleter<Testing_class>(5, &d_counter));
+        shared_ptr<Testing_class> sp(std::move(up));
+
+        EXPECT_EQ(sp->get_var(), 3);
+        EXPECT_EQ(t_counter, 0);
+        EXPECT_EQ(d_counter, 0);
+
+        weak_ptr<Testing_class> wp(sp);
+        sp.reset();
+
+        EXPECT_EQ(t_counter, 1);
+        EXPECT_EQ(d_counter, 1);
+    }
+}
+
+//self-assignment problem
+TEST(shared_ptr_and_weak_ptr, test_5)
+{
+    shared_ptr<int> sp = make_shared<int>(9);
+
+    EXPECT_NO_THROW(sp = sp);
+
+    weak_ptr<int> wp(sp);
+
+    sp.reset();
+
+    EXPECT_NO_THROW(wp = wp);
+}
+
+//Вспомогательная функция.
+void esft_test_helper(shared_ptr<Esft_test>& sp, Esft_test* esft)
+{
+    EXPECT_EQ(sp->var, esft->var);
+
+    weak_ptr<Esft_test> wp = sp;
+    shared_ptr<Esft_test> sp1(sp);
+
+    EXPECT_EQ(sp.use_count(), 2);
+    EXPECT_EQ(wp.DEBUG_weak_links_count(), 2); //там ещё в esft weak_ptr лежит
+
+    shared_ptr<Esft_test> sp2 = esft->shared_from_this();
+
+    EXPECT_EQ(wp.use_count(), 3);
+    EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
+    EXPECT_EQ(sp->var, sp2->var);
+}
+
+//проверка для простого конструктора
+TEST(enable_shared_from_this, test_1)
+{
+    weak_ptr<Esft_test> wp;
+
+    {
+        Esft_test* esft = new Esft_test(5);
+        shared_ptr<Esft_test> sp(esft);
+
+        esft_test_helper(sp, sp.get());
+
+        wp = sp;
+        EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
+    }
+
+    EXPECT_EQ(wp.DEBUG_weak_links_count(), 1); //объект удалился, значит и weak_ptr в нем тоже
+}
+
+//проверка для make_shared
+TEST(enable_shared_from_this, test_2)
+{
+    shared_ptr<Esft_test> sp = make_shared<Esft_test>(5);
+    esft_test_helper(sp, sp.get());
+}
+
+//weak_from_this(), try_shared_from_this(), owners of derived classes, copies of owned objects
+TEST(enable_shared_from_this, test_3)
+{
+    Esft_test unowned(1);
+
+    EXPECT_FALSE(unowned.try_shared_from_this());
+    EXPECT_EQ(unowned.weak_from_this().use_count(), 0);
+    EXPECT_THROW(unowned.shared_from_this(), bad_weak_ptr);
+
+    shared_ptr<Esft_derived> derived = make_shared<Esft_derived>(2);
+    weak_ptr<Esft_test> wp = derived->weak_from_this();
+
+    EXPECT_EQ(wp.DEBUG_weak_links_count(), 2);
+    EXPECT_EQ(derived->try_shared_from_this().get(), derived.get());
+    EXPECT_EQ(derived.use_count(), 1);
+
+    shared_ptr<Esft_test> again(derived.get(), [](Esft_test*) {});
+
+    EXPECT_EQ(derived->shared_from_this().use_count(), 2);
+    again.reset(new Esft_test(*derived));
+    EXPECT_EQ(again->shared_from_this(), again);
+    EXPECT_EQ(again->var, 2);
+
+    derived.reset();
+    EXPECT_FALSE(wp.lock());
+}
+
+//copies and resets of one shared_ptr from several threads
+TEST(shared_ptr_multithreaded, test_1)
+{
+    int counter = 0;
+
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 5);
+        std::vector<std::thread> threads;
+
+        for(size_t i = 0; i < 4; ++i)
+            threads.emplace_back([&sp]()
+            {
+                for(size_t j = 0; j < 100000; ++j)
+                {
+                    shared_ptr<Testing_class> copy(sp);
+                    weak_ptr<Testing_class> wp(copy);
+                    copy.reset();
+                }
+            });
+
+        for(std::thread& t : threads)
+            t.join();
+
+        weak_ptr<Testing_class> wp(sp);
+
+        EXPECT_EQ(sp.use_count(), 1);
+        EXPECT_EQ(wp.DEBUG_weak_links_count(), 1);
+        EXPECT_EQ(counter, 0);
+    }
+
+    EXPECT_EQ(counter, 1);
+}
+
+//weak_ptr.lock() racing with the last reset never revives the object
+TEST(shared_ptr_multithreaded, test_2)
+{
+    for(size_t i = 0; i < 1000; ++i)
+    {
+        int counter = 0;
+        std::atomic<bool> revived(false);
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 7);
+        weak_ptr<Testing_class> wp(sp);
+
+        std::thread locker([&wp, &revived, &counter]()
+        {
+            while(true)
+            {
+                shared_ptr<Testing_class> locked = wp.lock();
+                if(!locked)
+                    break;
+                if(locked->get_var() != 7 || counter)
+                    revived = true;
+            }
+        });
+
+        sp.reset();
+        locker.join();
+
+        EXPECT_FALSE(revived);
+        EXPECT_EQ(counter, 1);
+        EXPECT_FALSE(wp.lock());
+    }
+}
+
+//links made on one thread and dropped on others, also after the first thread has exited
+TEST(shared_ptr_multithreaded, test_3)
+{
+    int counter = 0;
+
+    std::thread([&counter]()
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 3);
+        std::vector<std::thread> threads;
+
+        for(size_t i = 0; i < 4; ++i)
+            threads.emplace_back([copy = sp]() mutable
+            {
+                weak_ptr<Testing_class> wp(copy);
+
+                copy.reset();
+                EXPECT_TRUE(wp.lock());
+            });
+
+        for(std::thread& t : threads)
+            t.join();
+
+        EXPECT_EQ(sp.use_count(), 1);
+        sp.reset();
+        EXPECT_EQ(counter, 1);
+    }).join();
+
+    std::vector<shared_ptr<Testing_class>> copies;
+    weak_ptr<Testing_class> wp;
+
+    std::thread([&counter, &copies, &wp]()
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 4);
+
+        copies.assign(3, sp);
+        wp = sp;
+    }).join();
+
+    EXPECT_EQ(wp.use_count(), 3);
+    copies.pop_back();
+    copies.pop_back();
+    EXPECT_EQ(wp.lock()->get_var(), 4);
+    EXPECT_EQ(counter, 1);
+    copies.clear();
+    EXPECT_EQ(counter, 2);
+    EXPECT_FALSE(wp.lock());
+}
+
+//atomic_shared_ptr: load, store, exchange, compare_exchange_strong
+TEST(atomic_shared_ptr, test_1)
+{
+    int counter = 0;
+
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 1), sp1 = make_shared<Testing_class>(&counter, 2);
+        atomic_shared_ptr<Testing_class> asp(sp);
+
+        EXPECT_TRUE(asp.is_lock_free());
+        EXPECT_EQ(asp.load(), sp);
+
+        size_t links = sp.use_count();
+        shared_ptr<Testing_class> loaded = asp.load();
+
+        EXPECT_EQ(sp.use_count(), links + 1); //копия владеет ссылкой на прокси объекта
+        EXPECT_EQ(loaded.use_count(), sp.use_count());
+
+        shared_ptr<Testing_class> expected = sp1;
+
+        EXPECT_FALSE(asp.compare_exchange_strong(expected, sp1));
+        EXPECT_EQ(expected, sp);
+        EXPECT_TRUE(asp.compare_exchange_strong(expected, sp1));
+        EXPECT_EQ(asp.load()->get_var(), 2);
+
+        EXPECT_EQ(asp.exchange(shared_ptr<Testing_class>()), sp1);
+        EXPECT_FALSE(asp.load());
+
+        sp.reset();
+        loaded.reset();
+        expected.reset();
+
+        EXPECT_EQ(counter, 1);
+
+        asp.store(sp1);
+        sp1.reset();
+
+        EXPECT_EQ(counter, 1);
+    }
+
+    EXPECT_EQ(counter, 2);
+}
+
+//atomic_shared_ptr: concurrent loads while a writer keeps replacing the value
+TEST(atomic_shared_ptr, test_2)
+{
+    int counter = 0;
+
+    {
+        //the destructors count in a plain int, so they all run on this thread
+        std::vector<shared_ptr<Testing_class>> stored(1, make_shared<Testing_class>(&counter, 0));
+        atomic_shared_ptr<Testing_class> asp(stored[0]);
+        std::atomic<bool> stop(false), broken(false);
+        std::vector<std::thread> readers;
+
+        for(size_t i = 0; i < 4; ++i)
+            readers.emplace_back([&asp, &stop, &broken]()
+            {
+                while(!stop)
+                    for(size_t j = 0; j < 100000; ++j)
+                        if(asp.load()->get_var() < 0)
+                            broken = true;
+            });
+
+        for(int i = 1; i <= 2000; ++i)
+        {
+            stored.push_back(make_shared<Testing_class>(&counter, i));
+            asp.store(stored.back());
+        }
+
+        stop = true;
+        for(std::thread& t : readers)
+            t.join();
+
+        stored.clear();
+
+        EXPECT_FALSE(broken);
+        EXPECT_EQ(asp.load()->get_var(), 2000);
+    }
+
+    EXPECT_EQ(counter, 2001);
+}
+
+//atomic_shared_ptr: many readers and no writer, so the local count keeps
+//crossing the refill mark while readers are preempted around it
+TEST(atomic_shared_ptr, test_3)
+{
+    int counter = 0;
+
+    {
+        atomic_shared_ptr<Testing_class> asp(make_shared<Testing_class>(&counter, 7));
+        std::atomic<bool> broken(false);
+        std::vector<std::thread> readers;
+        size_t threads = 8;
+
+#ifdef TUZ_SINGLE_THREADED
+        //the copies share counters that aren't atomic
+        threads = 1;
+#endif
+
+        for(size_t i = 0; i < threads; ++i)
+            readers.emplace_back([&asp, &broken]()
+            {
+                shared_ptr<Testing_class> kept[16];
+
+                for(size_t j = 0; j < 200000; ++j)
+                {
+                    kept[j % 16] = asp.load();
+
+                    if(kept[j % 16]->get_var() != 7)
+                        broken = true;
+                }
+            });
+
+        for(std::thread& t : readers)
+            t.join();
+
+        EXPECT_FALSE(broken);
+        EXPECT_EQ(counter, 0);
+        EXPECT_EQ(asp.load()->get_var(), 7);
+    }
+
+    EXPECT_EQ(counter, 1);
+}
+
+//atomic_shared_ptr: loaded values own the object like any other copy
+TEST(atomic_shared_ptr, test_4)
+{
+    int counter = 0;
+
+    {
+        shared_ptr<Testing_class> sp = make_shared<Testing_class>(&counter, 1);
+        atomic_shared_ptr<Testing_class> asp(sp);
+
+        EXPECT_EQ(sp.use_count(), 2);
+        EXPECT_EQ(asp.load().use_count(), 3);
+
+        weak_ptr<Testing_class> wp = asp.load();
+
+        asp.store(make_shared<Testing_class>(&counter, 2));
+
+        EXPECT_EQ(sp.use_count(), 1);
+        EXPECT_TRUE(wp.lock());
+        EXPECT_EQ(wp.lock(), sp);
+
+        shared_ptr<Testing_class> old = asp.exchange(sp);
+
+        EXPECT_EQ(old.use_count(), 1);
+        EXPECT_EQ(old->get_var(), 2);
+        EXPECT_EQ(sp.use_count(), 2);
+
+        shared_ptr<Testing_class> expected = asp.load();
+
+        EXPECT_TRUE(asp.compare_exchange_strong(expected, old));
+        EXPECT_EQ(sp.use_count(), 2);
+
+        sp.reset();
+        expected.reset();
+
+        EXPECT_FALSE(wp.lock());
+        EXPECT_EQ(counter, 1);
+    }
+
+    EXPECT_EQ(counter, 2);
+}
+
+struct Atomic_counted
+{
+    int value;
+
+    explicit Atomic_counted(int value) : value(value) {};
+};
+
+static instrument_counts counts_of_atomic_counted()
+{
+    for(const instrument_counts& counts : instrument_snapshot())
+        if(counts.type.find("Atomic_counted") != std::string::npos)
+            return counts;
+
+    return instrument_counts{};
+}
+
+//atomic_shared_ptr: instrument_snapshot counts the links readers pin, not the batches of the holder
+TEST(atomic_shared_ptr, test_5)
+{
+    shared_ptr<Atomic_counted> sp = make_shared<Atomic_counted>(1);
+    atomic_shared_ptr<Atomic_counted> asp(sp);
+
+#ifdef TUZ_INSTRUMENT
+    instrument_counts before = counts_of_atomic_counted();
+
+    for(size_t i = 0; i < 20000; ++i)
+        EXPECT_EQ(asp.load()->value, 1);
+
+    asp.store(sp);
+
+    instrument_counts after = counts_of_atomic_counted();
+
+    //pin and copy of every load, the copy in the new holder and the one in the old
+    EXPECT_EQ(after.shared_check_ins - before.shared_check_ins, 40001u);
+    EXPECT_EQ(after.shared_check_outs - before.shared_check_outs, 40001u);
+    EXPECT_EQ(after.proxies_created, 1u);
+    EXPECT_EQ(after.make_shared_allocations, 1u);
+
+    for(const instrument_counts& counts : instrument_snapshot())
+        EXPECT_EQ(counts.type.find("Atomic_stored"), std::string::npos);
+#else
+    EXPECT_TRUE(counts_of_atomic_counted().type.empty());
+#endif
+
+    EXPECT_EQ(asp.load(), sp);
 }
 
 int test(int argc, char** argv)
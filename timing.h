@@ -0,0 +1,256 @@
+#ifndef TIMING_H_INCLUDED
+#define TIMING_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+#ifdef TUZ_TIME_DESTRUCTORS
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#endif
+
+#include "utils.h"
+
+namespace tuz
+{
+
+//what the last releases of one type cost. Bucket i of a histogram counts
+//the values in [2^(i-1), 2^i), bucket 0 counts zeros.
+struct destructor_histogram
+{
+    static constexpr size_t buckets = 65;
+
+    std::string type;
+    size_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t total_bytes;
+    size_t ns[buckets];
+    size_t bytes[buckets];
+
+    //the upper end of the bucket that holds the fraction p of the
+    //destructions, e.g. p = 0.99 for the 99th percentile
+    uint64_t ns_percentile(double p) const noexcept;
+};
+
+inline uint64_t destructor_histogram::ns_percentile(double p) const noexcept
+{
+    size_t rank = size_t(p * count), seen = 0;
+
+    for(size_t i = 0; i < buckets; ++i)
+    {
+        seen += ns[i];
+
+        if(seen > rank || seen == count)
+            return i ? (i < 64 ? (uint64_t(1) << i) - 1 : UINT64_MAX) : 0;
+    }
+
+    return 0;
+}
+
+//the size of T when its type tells it, otherwise 0: the object of a
+//shared_ptr with its own deleter may be incomplete, or void
+template<typename T, typename = void>
+struct Known_size : std::integral_constant<size_t, 0>
+{
+};
+
+template<typename T>
+struct Known_size<T, decltype(void(sizeof(T)))> : std::integral_constant<size_t, sizeof(T)>
+{
+};
+
+#ifdef TUZ_TIME_DESTRUCTORS
+//The histograms of one type. Destructions are much rarer than links, so
+//unlike Instrument_record there are no shards.
+//Records are never destroyed and are trivially destructible, so objects
+//can still be timed while static objects are destroyed.
+class Destructor_record
+{
+private:
+    static constexpr size_t buckets = destructor_histogram::buckets;
+
+    const char* signature;
+    std::atomic<size_t> count{0};
+    std::atomic<uint64_t> total_ns{0}, max_ns{0}, total_bytes{0};
+    std::atomic<size_t> ns[buckets], bytes[buckets];
+    Destructor_record* next = nullptr;
+
+    static std::atomic<Destructor_record*>& all_records() noexcept;
+    static size_t bucket(uint64_t value) noexcept;
+
+    explicit Destructor_record(const char* signature) noexcept;
+
+public:
+    template<typename T>
+    static Destructor_record& of() noexcept;
+
+    void record(uint64_t elapsed_ns, size_t size) noexcept;
+    void reset() noexcept;
+    destructor_histogram snapshot() const;
+
+    static std::vector<destructor_histogram> snapshot_all();
+    static void reset_all() noexcept;
+};
+
+inline std::atomic<Destructor_record*>& Destructor_record::all_records() noexcept
+{
+    static std::atomic<Destructor_record*> the_list{nullptr};
+    return the_list;
+}
+
+inline size_t Destructor_record::bucket(uint64_t value) noexcept
+{
+    size_t i = 0;
+
+    for(; value; value >>= 1)
+        ++i;
+
+    return i;
+}
+
+inline Destructor_record::Destructor_record(const char* signature) noexcept :
+signature(signature)
+{
+    reset();
+
+    next = all_records().load(std::memory_order_relaxed);
+
+    while(!all_records().compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+        ;
+}
+
+template<typename T>
+Destructor_record& Destructor_record::of() noexcept
+{
+    static Destructor_record the_record(type_signature<T>());
+    return the_record;
+}
+
+inline void Destructor_record::record(uint64_t elapsed_ns, size_t size) noexcept
+{
+    count.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+    total_bytes.fetch_add(size, std::memory_order_relaxed);
+    ns[bucket(elapsed_ns)].fetch_add(1, std::memory_order_relaxed);
+    bytes[bucket(size)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t highest = max_ns.load(std::memory_order_relaxed);
+
+    while(elapsed_ns > highest && !max_ns.compare_exchange_weak(highest, elapsed_ns, std::memory_order_relaxed))
+        ;
+}
+
+//not atomic as a whole: destructions that run meanwhile may be half counted
+inline void Destructor_record::reset() noexcept
+{
+    count.store(0, std::memory_order_relaxed);
+    total_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+    total_bytes.store(0, std::memory_order_relaxed);
+
+    for(size_t i = 0; i < buckets; ++i)
+    {
+        ns[i].store(0, std::memory_order_relaxed);
+        bytes[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+inline destructor_histogram Destructor_record::snapshot() const
+{
+    destructor_histogram h;
+
+    h.type = type_name(signature);
+    h.total_ns = total_ns.load(std::memory_order_relaxed);
+    h.max_ns = max_ns.load(std::memory_order_relaxed);
+    h.total_bytes = total_bytes.load(std::memory_order_relaxed);
+    h.count = 0;
+
+    //the count is taken from the buckets, so percentiles add up
+    for(size_t i = 0; i < buckets; ++i)
+    {
+        h.ns[i] = ns[i].load(std::memory_order_relaxed);
+        h.bytes[i] = bytes[i].load(std::memory_order_relaxed);
+        h.count += h.ns[i];
+    }
+
+    return h;
+}
+
+//the types with the most time spent in destructors first
+inline std::vector<destructor_histogram> Destructor_record::snapshot_all()
+{
+    std::vector<destructor_histogram> all;
+
+    for(Destructor_record* r = all_records().load(std::memory_order_acquire); r; r = r->next)
+        if(r->count.load(std::memory_order_relaxed))
+            all.push_back(r->snapshot());
+
+    std::sort(all.begin(), all.end(), [](const destructor_histogram& a, const destructor_histogram& b)
+    {
+        return a.total_ns > b.total_ns;
+    });
+
+    return all;
+}
+
+inline void Destructor_record::reset_all() noexcept
+{
+    for(Destructor_record* r = all_records().load(std::memory_order_acquire); r; r = r->next)
+        r->reset();
+}
+#endif
+
+//Times the scope it lives in as the destruction of a T of the given size;
+//proxies put one around the dispose of their object. Without
+//TUZ_TIME_DESTRUCTORS it is empty.
+template<typename T>
+class Destructor_timer
+{
+#ifdef TUZ_TIME_DESTRUCTORS
+private:
+    std::chrono::steady_clock::time_point start;
+    size_t size;
+
+public:
+    explicit Destructor_timer(size_t size) noexcept : start(std::chrono::steady_clock::now()), size(size) {};
+
+    ~Destructor_timer()
+    {
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        Destructor_record::of<typename std::remove_cv<T>::type>().record(elapsed, size);
+    };
+#else
+public:
+    explicit Destructor_timer(size_t) noexcept {};
+#endif
+
+    Destructor_timer(const Destructor_timer&) = delete;
+    Destructor_timer& operator=(const Destructor_timer&) = delete;
+};
+
+//one histogram for every type destroyed since the last reset, the most
+//time first; empty without TUZ_TIME_DESTRUCTORS
+inline std::vector<destructor_histogram> destructor_histograms()
+{
+#ifdef TUZ_TIME_DESTRUCTORS
+    return Destructor_record::snapshot_all();
+#else
+    return std::vector<destructor_histogram>();
+#endif
+}
+
+inline void reset_destructor_histograms() noexcept
+{
+#ifdef TUZ_TIME_DESTRUCTORS
+    Destructor_record::reset_all();
+#endif
+}
+
+}
+
+#endif // TIMING_H_INCLUDED
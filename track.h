@@ -0,0 +1,298 @@
+#ifndef TRACK_H_INCLUDED
+#define TRACK_H_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#ifdef TUZ_TRACK_PROXIES
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#endif
+#endif
+
+#include "utils.h"
+
+//how many return addresses identify the site that created a proxy
+#ifndef TUZ_TRACK_DEPTH
+#define TUZ_TRACK_DEPTH 12
+#endif
+
+//every how many proxies a thread takes a backtrace, until
+//set_track_sample_period() says otherwise
+#ifndef TUZ_TRACK_SAMPLE
+#define TUZ_TRACK_SAMPLE 64
+#endif
+
+namespace tuz
+{
+
+class Proxy_base;
+
+struct tracked_block
+{
+    size_t shared_links;
+    size_t weak_links;  //not counting the one the owners hold together
+    size_t bytes;       //of the proxy, and of the object when they share a block
+    double age;         //seconds since the proxy was created
+};
+
+//the proxies of one type created at one site; the proxies whose backtrace
+//wasn't taken are one site per type
+struct tracked_site
+{
+    std::string type;
+    std::vector<std::string> backtrace; //innermost frame first, empty without a backtrace
+    size_t bytes;                       //of all the blocks
+    std::vector<tracked_block> blocks;  //oldest first
+};
+
+#ifdef TUZ_TRACK_PROXIES
+//a backtrace, stored once per shard that saw it
+struct Track_site
+{
+    Track_site* next;
+    size_t hash;
+    int depth;
+    void* frames[TUZ_TRACK_DEPTH];
+};
+
+//what Proxy_base keeps for the registry under TUZ_TRACK_PROXIES
+struct Track_node
+{
+    Track_node* prev;
+    Track_node* next;
+    Proxy_base* proxy = nullptr;    //null until the proxy is registered
+    const char* signature;          //from type_signature<T>()
+    size_t bytes;
+    const Track_site* site;
+    int64_t created;                //steady_clock nanoseconds
+    size_t shard;
+};
+
+//Every live proxy, on intrusive lists in shards. A thread adds its proxies
+//to its own shard, so registrations mostly take an uncontended lock; a
+//proxy released on another thread is removed from the shard it is on.
+//Proxies register once their object exists and leave in ~Proxy_base, and
+//a snapshot holds the lock of a shard while it reads its proxies, so it
+//never sees a freed one.
+//A backtrace costs microseconds, much more than the rest of registering,
+//so only a sample of the proxies get one, like in heap profilers.
+//The registry is never destroyed: proxies may die during static destruction.
+class Proxy_registry
+{
+private:
+    static constexpr size_t shards = 16;
+    static constexpr size_t site_buckets = 256;
+
+    struct alignas(cache_line_size) Shard
+    {
+        std::mutex mutex;
+        Track_node* head = nullptr;
+        Track_site* sites[site_buckets] = {};
+    };
+
+    Shard shard[shards];
+    std::atomic<size_t> sample_period{TUZ_TRACK_SAMPLE};
+
+    Proxy_registry() = default;
+    Proxy_registry(const Proxy_registry&) = delete;
+    Proxy_registry& operator=(const Proxy_registry&) = delete;
+
+    static size_t shard_index() noexcept;
+    bool take_sample() noexcept;
+    static const Track_site* intern(Shard& s, void* const* frames, int depth) noexcept;
+
+public:
+    static Proxy_registry& instance();
+
+    void add(Track_node& node, Proxy_base* proxy, const char* signature, size_t bytes) noexcept;
+    void remove(Track_node& node) noexcept;
+    void set_sample_period(size_t period) noexcept;
+    //defined in proxy.h, where the counts of a proxy can be read
+    std::vector<tracked_site> snapshot();
+};
+
+inline Proxy_registry& Proxy_registry::instance()
+{
+    static Proxy_registry* the_registry = new Proxy_registry;
+    return *the_registry;
+}
+
+//threads take the shards in turn
+inline size_t Proxy_registry::shard_index() noexcept
+{
+    static std::atomic<size_t> next_index{0};
+    static thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % shards;
+
+    return index;
+}
+
+//the first proxy of a thread and then every sample_period-th one
+inline bool Proxy_registry::take_sample() noexcept
+{
+    static thread_local size_t countdown = 0;
+    size_t period = sample_period.load(std::memory_order_relaxed);
+
+    if(!period)
+        return false;
+
+    //the period may have shrunk since the last sample
+    if(countdown > period)
+        countdown = period;
+
+    if(countdown > 1)
+    {
+        --countdown;
+        return false;
+    }
+
+    countdown = period;
+
+    return true;
+}
+
+//null when the site can't be stored, the proxy is then reported without one
+inline const Track_site* Proxy_registry::intern(Shard& s, void* const* frames, int depth) noexcept
+{
+    size_t hash = size_t(depth);
+
+    for(int i = 0; i < depth; ++i)
+        hash = (hash ^ reinterpret_cast<uintptr_t>(frames[i])) * 0x100000001b3;
+
+    Track_site*& bucket = s.sites[hash % site_buckets];
+
+    for(Track_site* site = bucket; site; site = site->next)
+        if(site->hash == hash && site->depth == depth && std::equal(frames, frames + depth, site->frames))
+            return site;
+
+    Track_site* site = new(std::nothrow) Track_site;
+
+    if(!site)
+        return nullptr;
+
+    site->next = bucket;
+    site->hash = hash;
+    site->depth = depth;
+    std::copy(frames, frames + depth, site->frames);
+    bucket = site;
+
+    return site;
+}
+
+inline void Proxy_registry::add(Track_node& node, Proxy_base* proxy, const char* signature, size_t bytes) noexcept
+{
+    void* frames[TUZ_TRACK_DEPTH];
+    int depth = 0;
+
+#if __has_include(<execinfo.h>)
+    if(take_sample())
+        depth = backtrace(frames, TUZ_TRACK_DEPTH);
+#endif
+
+    node.signature = signature;
+    node.bytes = bytes;
+    node.created = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    node.shard = shard_index();
+
+    Shard& s = shard[node.shard];
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    node.site = depth ? intern(s, frames, depth) : nullptr;
+    node.proxy = proxy;
+    node.prev = nullptr;
+    node.next = s.head;
+
+    if(s.head)
+        s.head->prev = &node;
+
+    s.head = &node;
+}
+
+inline void Proxy_registry::remove(Track_node& node) noexcept
+{
+    if(!node.proxy)
+        return;
+
+    Shard& s = shard[node.shard];
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    if(node.prev)
+        node.prev->next = node.next;
+    else
+        s.head = node.next;
+
+    if(node.next)
+        node.next->prev = node.prev;
+}
+
+inline void Proxy_registry::set_sample_period(size_t period) noexcept
+{
+    sample_period.store(period, std::memory_order_relaxed);
+}
+#endif
+
+//every period-th proxy a thread creates gets a backtrace: 1 is all of
+//them, 0 none; does nothing without TUZ_TRACK_PROXIES
+inline void set_track_sample_period(size_t period) noexcept
+{
+#ifdef TUZ_TRACK_PROXIES
+    Proxy_registry::instance().set_sample_period(period);
+#else
+    (void)period;
+#endif
+}
+
+//the live proxies grouped by type and creation site, the most bytes
+//first; empty without TUZ_TRACK_PROXIES
+inline std::vector<tracked_site> tracked_proxies()
+{
+#ifdef TUZ_TRACK_PROXIES
+    return Proxy_registry::instance().snapshot();
+#else
+    return std::vector<tracked_site>();
+#endif
+}
+
+//a report of tracked_proxies() with the counts of the first
+//blocks_per_site blocks of every site
+inline void dump_tracked_proxies(std::FILE* out = stderr, size_t blocks_per_site = 4)
+{
+#ifdef TUZ_TRACK_PROXIES
+    std::vector<tracked_site> sites = tracked_proxies();
+    size_t blocks = 0, bytes = 0;
+
+    for(const tracked_site& site : sites)
+    {
+        blocks += site.blocks.size();
+        bytes += site.bytes;
+    }
+
+    std::fprintf(out, "%zu live proxies, %zu bytes, %zu sites\n", blocks, bytes, sites.size());
+
+    for(const tracked_site& site : sites)
+    {
+        std::fprintf(out, "\n%zu bytes in %zu blocks of %s, the oldest %.3f s old\n",
+            site.bytes, site.blocks.size(), site.type.c_str(), site.blocks.front().age);
+
+        for(const std::string& frame : site.backtrace)
+            std::fprintf(out, "    at %s\n", frame.c_str());
+
+        for(size_t i = 0; i < site.blocks.size() && i < blocks_per_site; ++i)
+            std::fprintf(out, "    shared %zu, weak %zu, %.3f s old\n",
+                site.blocks[i].shared_links, site.blocks[i].weak_links, site.blocks[i].age);
+    }
+#else
+    std::fprintf(out, "proxy tracking is off, build with TUZ_TRACK_PROXIES\n");
+#endif
+}
+
+}
+
+#endif // TRACK_H_INCLUDED
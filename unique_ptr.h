@@ -2,6 +2,9 @@
 #define UNIQUE_PTR_H_INCLUDED
 
 #include <algorithm>
+#include <cstddef>
+
+#include "utils.h"
 
 namespace tuz
 {
@@ -19,14 +22,28 @@ void default_delete<T>::operator()(T* ptr) const
     delete ptr;
 }
 
+template<class T>
+class default_delete<T[]>
+{
+public:
+    void operator()(T*) const;
+};
+
+template<class T>
+void default_delete<T[]>::operator()(T* ptr) const
+{
+    delete[] ptr;
+}
+
+//a stateless deleter is kept as an empty base, so unique_ptr<T> is as
+//small as T*
 template<class T, class D = default_delete<T>>
-class unique_ptr
+class unique_ptr : private Ebo_holder<D>
 {
     T* ptr;
-    D deleter;
 
 public:
-    explicit unique_ptr(T* ptr, const D& deleter = default_delete<T>());
+    explicit unique_ptr(T* ptr, const D& deleter = D());
     unique_ptr(const unique_ptr& up) = delete;
     unique_ptr(unique_ptr&& up) noexcept;
     unique_ptr() noexcept;
@@ -40,6 +57,7 @@ public:
     void reset(T* ptr = nullptr) noexcept;
 
     T* get() const noexcept;
+    D& get_deleter() noexcept;
     const D& get_deleter() const;
     operator bool() const noexcept;
     T& operator*() const noexcept;
@@ -55,41 +73,42 @@ public:
 
 template<class T, class D>
 unique_ptr<T, D>::unique_ptr() noexcept :
-unique_ptr<T, D>(nullptr)
+ptr(nullptr)
 {
 }
 
 template<class T, class D>
-unique_ptr<T, D>::unique_ptr(T* ptr, const D& deleter) : ptr(ptr), deleter(deleter)
+unique_ptr<T, D>::unique_ptr(T* ptr, const D& deleter) : Ebo_holder<D>(deleter), ptr(ptr)
 {
 }
 
 template<class T, class D>
 unique_ptr<T, D>::unique_ptr(unique_ptr&& up) noexcept :
-unique_ptr<T, D>()
+Ebo_holder<D>(std::move(up.get_deleter())), ptr(up.release())
 {
-    swap(up);
 }
 
 template<class T, class D>
 unique_ptr<T, D>& unique_ptr<T, D>::operator=(unique_ptr&& up) noexcept
 {
-    swap(up);
-    up.reset();
+    reset(up.release());
+    get_deleter() = std::move(up.get_deleter());
     return *this;
 }
 
+//moved-from pointers are the common case, they don't reach the deleter
 template<class T, class D>
 unique_ptr<T, D>::~unique_ptr()
 {
-    deleter(ptr);
+    if(ptr)
+        get_deleter()(ptr);
 }
 
 template<class T, class D>
 void unique_ptr<T, D>::swap(unique_ptr& up) noexcept
 {
     std::swap(ptr, up.ptr);
-    std::swap(deleter, up.deleter);
+    std::swap(get_deleter(), up.get_deleter());
 }
 
 template<class T, class D>
@@ -103,8 +122,11 @@ T* unique_ptr<T, D>::release() noexcept
 template<class T, class D>
 void unique_ptr<T, D>::reset(T* ptr_) noexcept
 {
-    deleter(ptr);
+    T* old = ptr;
     ptr = ptr_;
+
+    if(old)
+        get_deleter()(old);
 }
 
 template<class T, class D>
@@ -167,19 +189,172 @@ T* unique_ptr<T, D>::get() const noexcept
     return ptr;
 }
 
+template<class T, class D>
+D& unique_ptr<T, D>::get_deleter() noexcept
+{
+    return Ebo_holder<D>::held();
+}
+
 template<class T, class D>
 const D& unique_ptr<T, D>::get_deleter() const
 {
-    return deleter;
+    return Ebo_holder<D>::held();
+}
+
+template<class T, class D>
+class unique_ptr<T[], D> : private Ebo_holder<D>
+{
+    T* ptr;
+
+public:
+    explicit unique_ptr(T* ptr, const D& deleter = D());
+    unique_ptr(const unique_ptr& up) = delete;
+    unique_ptr(unique_ptr&& up) noexcept;
+    unique_ptr() noexcept;
+    ~unique_ptr();
+
+    unique_ptr& operator=(unique_ptr&& up) noexcept;
+    unique_ptr& operator=(const unique_ptr& up) = delete;
+
+    T* release() noexcept;
+    void swap(unique_ptr& up) noexcept;
+    void reset(T* ptr = nullptr) noexcept;
+
+    T* get() const noexcept;
+    D& get_deleter() noexcept;
+    const D& get_deleter() const;
+    operator bool() const noexcept;
+    T& operator[](ptrdiff_t i) const noexcept;
+
+    bool operator==(const unique_ptr& up) const noexcept;
+    bool operator!=(const unique_ptr& up) const noexcept;
+};
+
+template<class T, class D>
+unique_ptr<T[], D>::unique_ptr() noexcept :
+ptr(nullptr)
+{
+}
+
+template<class T, class D>
+unique_ptr<T[], D>::unique_ptr(T* ptr, const D& deleter) : Ebo_holder<D>(deleter), ptr(ptr)
+{
+}
+
+template<class T, class D>
+unique_ptr<T[], D>::unique_ptr(unique_ptr&& up) noexcept :
+Ebo_holder<D>(std::move(up.get_deleter())), ptr(up.release())
+{
+}
+
+template<class T, class D>
+unique_ptr<T[], D>& unique_ptr<T[], D>::operator=(unique_ptr&& up) noexcept
+{
+    reset(up.release());
+    get_deleter() = std::move(up.get_deleter());
+    return *this;
+}
+
+template<class T, class D>
+unique_ptr<T[], D>::~unique_ptr()
+{
+    if(ptr)
+        get_deleter()(ptr);
+}
+
+template<class T, class D>
+void unique_ptr<T[], D>::swap(unique_ptr& up) noexcept
+{
+    std::swap(ptr, up.ptr);
+    std::swap(get_deleter(), up.get_deleter());
+}
+
+template<class T, class D>
+T* unique_ptr<T[], D>::release() noexcept
+{
+    T* tmp = ptr;
+    ptr = nullptr;
+    return tmp;
+}
+
+template<class T, class D>
+void unique_ptr<T[], D>::reset(T* ptr_) noexcept
+{
+    T* old = ptr;
+    ptr = ptr_;
+
+    if(old)
+        get_deleter()(old);
+}
+
+template<class T, class D>
+T& unique_ptr<T[], D>::operator[](ptrdiff_t i) const noexcept
+{
+    return ptr[i];
+}
+
+template<class T, class D>
+bool unique_ptr<T[], D>::operator==(const unique_ptr& up) const noexcept
+{
+    return ptr == up.ptr;
+}
+
+template<class T, class D>
+bool unique_ptr<T[], D>::operator!=(const unique_ptr& up) const noexcept
+{
+    return !(*this == up);
+}
+
+template<class T, class D>
+unique_ptr<T[], D>::operator bool() const noexcept
+{
+    return ptr != nullptr;
+}
+
+template<class T, class D>
+T* unique_ptr<T[], D>::get() const noexcept
+{
+    return ptr;
+}
+
+template<class T, class D>
+D& unique_ptr<T[], D>::get_deleter() noexcept
+{
+    return Ebo_holder<D>::held();
+}
+
+template<class T, class D>
+const D& unique_ptr<T[], D>::get_deleter() const
+{
+    return Ebo_holder<D>::held();
 }
 
 template<class T, class... R>
-unique_ptr<T> make_unique(R&&... arg)
+Enable_if_not_array<T, unique_ptr<T>> make_unique(R&&... arg)
 {
     T* ptr = new T(std::forward<R>(arg)...);
     return unique_ptr<T>(ptr);
 }
 
+template<class T>
+Enable_if_unbounded_array<T, unique_ptr<T>> make_unique(size_t count)
+{
+    return unique_ptr<T>(new typename std::remove_extent<T>::type[count]());
+}
+
+//default-initialized, so buffers that are about to be filled aren't zeroed first
+template<class T>
+Enable_if_not_array<T, unique_ptr<T>> make_unique_for_overwrite()
+{
+    return unique_ptr<T>(new T);
+}
+
+template<class T>
+Enable_if_unbounded_array<T, unique_ptr<T>> make_unique_for_overwrite(size_t count)
+{
+    return unique_ptr<T>(new typename std::remove_extent<T>::type[count]);
+}
+
 }
 
 namespace std
@@ -1,9 +1,103 @@
 #ifndef UTILS_H_INCLUDED
 #define UTILS_H_INCLUDED
 
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
 template<typename T>
 class Identity
 {
 };
 
+class Adopt_link
+{
+};
+
+//default-initialize instead of value-initialize
+class For_overwrite
+{
+};
+
+namespace tuz
+{
+
+constexpr size_t cache_line_size = 64;
+
+//the signature names T, also when T is incomplete; one address per type
+template<typename T>
+const char* type_signature() noexcept
+{
+    return __PRETTY_FUNCTION__;
+}
+
+//T out of a signature from type_signature<T>()
+inline std::string type_name(const char* signature)
+{
+    const char* begin = std::strstr(signature, "T = ");
+
+    if(!begin)
+        return signature;
+
+    begin += 4;
+
+    return std::string(begin, std::strcspn(begin, ";]"));
+}
+
+}
+
+//keeps a stateless D as an empty base, so it takes no space in the owner
+template<typename D, bool = std::is_empty<D>::value && !std::is_final<D>::value>
+class Ebo_holder : private D
+{
+public:
+    Ebo_holder() = default;
+    explicit Ebo_holder(D&& d) : D(std::move(d)) {};
+    explicit Ebo_holder(const D& d) : D(d) {};
+
+    D& held() noexcept
+    {
+        return *this;
+    };
+    const D& held() const noexcept
+    {
+        return *this;
+    };
+};
+
+template<typename D>
+class Ebo_holder<D, false>
+{
+private:
+    D d;
+
+public:
+    Ebo_holder() = default;
+    explicit Ebo_holder(D&& d) : d(std::move(d)) {};
+    explicit Ebo_holder(const D& d) : d(d) {};
+
+    D& held() noexcept
+    {
+        return d;
+    };
+    const D& held() const noexcept
+    {
+        return d;
+    };
+};
+
+template<typename U, typename T>
+using Enable_if_convertible = typename std::enable_if<std::is_convertible<U*, T*>::value>::type;
+
+template<typename T, typename R>
+using Enable_if_not_array = typename std::enable_if<!std::is_array<T>::value, R>::type;
+
+template<typename T, typename R>
+using Enable_if_unbounded_array = typename std::enable_if<std::is_array<T>::value && !std::extent<T>::value, R>::type;
+
+template<typename T, typename R>
+using Enable_if_bounded_array = typename std::enable_if<(std::extent<T>::value > 0), R>::type;
+
 #endif // UTILS_H_INCLUDED
@@ -7,21 +7,37 @@ namespace tuz
 {
 
 template<typename T>
-weak_ptr<T>::weak_ptr() noexcept
+constexpr weak_ptr<T>::weak_ptr() noexcept
 {
-    SW_base<T, weak_ptr>::set_proxy();
 }
 
 template<typename T>
 weak_ptr<T>::weak_ptr(const weak_ptr<T>& wp) noexcept
 {
-    SW_base<T, weak_ptr>::set_proxy(wp.proxy);
+    SW_base<T, weak_ptr>::set_proxy(wp.proxy, wp.ptr);
+}
+
+template<typename T>
+weak_ptr<T>::weak_ptr(weak_ptr<T>&& wp) noexcept
+{
+    SW_base<T, weak_ptr>::adopt_proxy(wp.proxy, wp.ptr);
+    wp.adopt_proxy(nullptr, nullptr);
 }
 
+//the object may already be gone, and converting a dangling pointer to a
+//virtual base would read its vtable, so the pointer is taken from lock()
 template<typename T>
-weak_ptr<T>::weak_ptr(const shared_ptr<T>& sp) noexcept
+template<typename U, typename>
+weak_ptr<T>::weak_ptr(const weak_ptr<U>& wp) noexcept
 {
-    SW_base<T, weak_ptr>::set_proxy(sp.proxy);
+    SW_base<T, weak_ptr>::set_proxy(wp.proxy, wp.lock().get());
+}
+
+template<typename T>
+template<typename U, typename>
+weak_ptr<T>::weak_ptr(const shared_ptr<U>& sp) noexcept
+{
+    SW_base<T, weak_ptr>::set_proxy(sp.proxy, sp.ptr);
 }
 
 template<typename T>
@@ -35,7 +51,15 @@ weak_ptr<T>& weak_ptr<T>::operator=(const weak_ptr& wp) noexcept
 }
 
 template<typename T>
-weak_ptr<T>& weak_ptr<T>::operator=(const shared_ptr<T>& sp) noexcept
+weak_ptr<T>& weak_ptr<T>::operator=(weak_ptr&& wp) noexcept
+{
+    weak_ptr<T>(std::move(wp)).swap(*this);
+    return *this;
+}
+
+template<typename T>
+template<typename U>
+weak_ptr<T>& weak_ptr<T>::operator=(const shared_ptr<U>& sp) noexcept
 {
     return *this = weak_ptr(sp);
 }
@@ -54,13 +78,25 @@ void weak_ptr<T>::reset() noexcept
 }
 
 template<typename T>
-shared_ptr<T> weak_ptr<T>::lock() const
+void weak_ptr<T>::swap(weak_ptr& wp) noexcept
+{
+    SW_base<T, weak_ptr>::swap(wp);
+}
+
+//expired() followed by a separate check_in could revive an object that
+//another thread is deleting, so the shared link is only taken while non-zero
+template<typename T>
+shared_ptr<T> weak_ptr<T>::lock() const noexcept
 {
-    if(SW_base<T, weak_ptr>::proxy->expired())
+    Proxy_base* proxy = SW_base<T, weak_ptr>::proxy;
+
+    if(!proxy || !proxy->try_check_in(Identity<shared_ptr<T>>()))
         return shared_ptr<T>();
-    else
-        return shared_ptr<T>(*this);
-    //здесь исключение никогда не будет кинуто, потому что proxy 100% не протухшая
+
+    //the adopted link skips SW_base, which profiles the others
+    profile_link<shared_ptr<T>>(Link_event::check_in);
+
+    return shared_ptr<T>(*proxy, SW_base<T, weak_ptr>::ptr, Adopt_link());
 }
 
 }